@@ -1,66 +1,507 @@
 #include "contraction.hh"
 #include "label_edges.hh"
+#include "core_table.hh"
+#include "phast.hh"
+#include "knn.hh"
+#include "cch.hh"
+#include "hub_labels.hh"
 #include <ctime>
 #include <chrono>
+#include <random>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <cstdio>
+#include <sys/resource.h>
 
 using namespace ch;
 
+// Sections that can be skipped (after preprocessing and the random and
+// Dijkstra rank queries), named as in the JSON output:
+const std::vector<std::string> optional_sections = {
+    "hub_labels", "pool_queries", "path_queries", "distance_table", "phast",
+    "rphast", "knn", "partial_hierarchy", "cch"
+};
+
+void usage_exit (char **argv) {
+    std::cerr <<"\nUsage: "<< argv[0] <<" [-lazy] [-partial] [-queries q]"
+              <<" [-sources s] [-pairs p] [-seed r]\n"
+              <<"       [-skip sections] [-only sections] [graph]\n"
+              <<"\nBenchmarks contraction hierarchies on the graph in file"
+              <<" [graph]\n(default test_data/road_corsica.txt, one edge per"
+              <<" line: [src] [dst] [length]).\n"
+              <<"Queries: [q] random pairs (default 10000), and pairs by"
+              <<" Dijkstra rank\n2^r from [s] random sources (default 100)."
+              <<" One-to-many algorithms are run\non [p] sources and"
+              <<" targets (default 300). Random choices depend on [r].\n"
+              <<"With -partial, a partial hierarchy is also queried with"
+              <<" a core table\n(skipped for a core of more than "
+              << core_table::max_core_size <<" nodes).\n"
+              <<"Sections (comma separated) of -skip are not run, with"
+              <<" -only only those are run\n(-only partial_hierarchy"
+              <<" implies -partial) among:\n ";
+    for (const std::string & sec : optional_sections) { std::cerr <<" "<< sec; }
+    std::cerr <<".\n"
+              <<"Results are printed in JSON on the standard output.\n";
+    exit(1);
+}
+
+// Comma separated names of [list].
+std::vector<std::string> split_names(const std::string & list) {
+    std::vector<std::string> names;
+    std::istringstream is(list);
+    for (std::string name; std::getline(is, name, ','); ) {
+        if ( ! name.empty()) { names.push_back(name); }
+    }
+    return names;
+}
+
+// [s] as a JSON string literal.
+std::string json_string(const std::string & s) {
+    std::string js = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            js += '\\';
+            js += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) { // control
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", unsigned(c));
+            js += esc;
+        } else {
+            js += c;
+        }
+    }
+    return js + "\"";
+}
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now()
+                                                     - start).count();
+}
+
+std::size_t peak_memory_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss; // in KB on Linux
+}
+
+// Latencies (in microseconds) and settled nodes of a set of queries.
+struct query_stats {
+    std::vector<double> latency;
+    std::vector<std::size_t> settled;
+    std::size_t errors = 0; // wrong distances
+
+    void add(double us, std::size_t nb_settled) {
+        latency.push_back(us);
+        settled.push_back(nb_settled);
+    }
+
+    // Nearest rank percentile.
+    template <typename T>
+    static T percentile(std::vector<T> & v, double p) {
+        if (v.empty()) return T(0);
+        std::size_t i = std::size_t(std::ceil(p / 100. * v.size()));
+        if (i > 0) --i;
+        std::nth_element(v.begin(), v.begin() + i, v.end());
+        return v[i];
+    }
+
+    template <typename T>
+    static double mean(const std::vector<T> & v) {
+        double sum = 0;
+        for (T x : v) sum += x;
+        return v.empty() ? 0 : sum / v.size();
+    }
+
+    void json(std::ostream & os, const std::string & indent) {
+        os <<"{\n"<< indent <<"  \"count\": "<< latency.size()
+           <<",\n"<< indent <<"  \"errors\": "<< errors
+           <<",\n"<< indent <<"  \"latency_us\": {"
+           <<"\"mean\": "<< mean(latency)
+           <<", \"p50\": "<< percentile(latency, 50)
+           <<", \"p99\": "<< percentile(latency, 99)
+           <<", \"p999\": "<< percentile(latency, 99.9) <<"}"
+           <<",\n"<< indent <<"  \"settled\": {"
+           <<"\"mean\": "<< mean(settled)
+           <<", \"p50\": "<< percentile(settled, 50)
+           <<", \"p99\": "<< percentile(settled, 99)
+           <<", \"p999\": "<< percentile(settled, 99.9)
+           <<", \"max\": "<< percentile(settled, 100) <<"}\n"
+           << indent <<"}";
+    }
+};
+
 int main(int argc, char **argv) {
 
-    assert(argc == 2 || argc == 3);
-    auto n_nodes = std::stoll(std::string(argv[1]));
-    std::cout <<"Test from n_nodes="<< n_nodes <<"\n"<< std::flush;
+    // ------- helper functions for manipulating args ----------
+    auto i_arg = [&argc,&argv](std::string a) {
+        for (int i = 1; i < argc; ++i)
+            if (a == argv[i])
+                return i;
+        return -1;
+    };
+    auto del_arg = [&argc,&argv,i_arg](std::string a) {
+        int i = i_arg(a);
+        if (i >= 0) {
+            for (int j = i+1; j < argc; ++j)
+                argv[j-1] = argv[j];
+            --argc;
+            return true;
+        }
+        return false;
+    };
+    auto del_arg_value = [&argc,&argv,i_arg](std::string a, std::string def) {
+        int i = i_arg(a);
+        std::string val = def;
+        if (i >= 0 && i+1 < argc) {
+            val = argv[i+1];
+            for (int j = i+2; j < argc; ++j)
+                argv[j-2] = argv[j];
+            argc -= 2;
+        }
+        return val;
+    };
+
+    bool do_lazy = del_arg("-lazy");
+    bool do_partial = del_arg("-partial");
+    std::size_t n_queries = std::stoull(del_arg_value("-queries", "10000"));
+    std::size_t n_sources = std::stoull(del_arg_value("-sources", "100"));
+    std::size_t n_pairs = std::stoull(del_arg_value("-pairs", "300"));
+    std::uint64_t seed = std::stoull(del_arg_value("-seed", "1"));
+    std::vector<std::string> only = split_names(del_arg_value("-only", ""));
+    std::vector<std::string> skip = split_names(del_arg_value("-skip", ""));
+    if (argc > 2) { usage_exit(argv); }
+    auto listed = [](const std::vector<std::string> & names,
+                     const std::string & sec) {
+        return std::find(names.begin(), names.end(), sec) != names.end();
+    };
+    for (const std::string & sec : only) {
+        if ( ! listed(optional_sections, sec)) { usage_exit(argv); }
+    }
+    for (const std::string & sec : skip) {
+        if ( ! listed(optional_sections, sec)) { usage_exit(argv); }
+    }
+    // Whether section [sec] (of optional_sections) is run:
+    auto run = [&only, &skip, do_partial, &listed](const std::string & sec) {
+        if ( ! only.empty()) return listed(only, sec);
+        return ! listed(skip, sec)
+            && (sec != "partial_hierarchy" || do_partial);
+    };
+    std::string fgraph = argc == 2 ? std::string(argv[1])
+        : "test_data/road_corsica.txt";
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout <<"{\n";
 
-    std::string fname_rank = "";
-    if (argc == 3) { fname_rank = std::string(argv[2]); }
-    
+    // ------------------------- load graph ----------------------
     digraph g;
-    label_edges edges_road = label_edges("test_data/road_corsica.txt");
-    for (edge e : edges_road.edges) { g.add_edge(e); }
-    std::cout <<"road graph : n="<< g.nb_nodes()
-              <<" m="<< g.nb_edges() <<"\n";
+    {
+        auto start = bench_clock::now();
+        label_edges edges;
+        g = edges.read_graph(fgraph);
+        std::cerr <<"graph: n="<< g.nb_nodes() <<" m="<< g.nb_edges() <<"\n";
+        std::cout <<"  \"graph\": {\"file\": "<< json_string(fgraph)
+                  <<", \"nodes\": "<< g.nb_nodes()
+                  <<", \"edges\": "<< g.nb_edges()
+                  <<", \"load_ms\": "<< elapsed_ms(start)
+                  <<", \"graph_bytes\": "<< g.memory_bytes()
+                  <<", \"labels_bytes\": "<< edges.memory_bytes() <<"},\n";
+    }
+    if (g.nb_nodes() == 0) { usage_exit(argv); }
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<std::size_t> rnd_node(0, g.nb_nodes() - 1);
+
+    // ------------------------- preprocessing -------------------
+    contraction contr(g);
+    if (do_lazy) { contr.set_ordering(contraction::ordering::lazy_priority); }
+    {
+        auto start = bench_clock::now();
+        digraph g_ch = contr.contract();
+        double ms = elapsed_ms(start);
+        const std::size_t input_edges = g.no_loop().nb_edges();
+        std::cout <<"  \"preprocessing\": {\"ordering\": \""
+                  << (do_lazy ? "lazy" : "rounds")
+                  <<"\", \"ms\": "<< ms
+                  <<", \"hierarchy_edges\": "<< g_ch.nb_edges()
+                  <<", \"shortcuts\": "<< g_ch.nb_edges() - input_edges
+                  <<", \"peak_memory_kb\": "<< peak_memory_kb() <<"},\n";
+        std::cout <<"  \"contraction_stats\": ";
+        contr.stats().json(std::cout);
+        std::cout <<",\n";
+    }
+    ch_query & query = contr.query_engine();
+    traversal trav;
 
-    // All pairs with dijkstra:
+    // ------------------------- random queries ------------------
     {
-        auto start = std::chrono::high_resolution_clock::now();
-        traversal trav;
-        std::size_t n = std::min(std::size_t(n_nodes), g.nb_nodes());
-        const std::size_t incr = g.nb_nodes() > n ? g.nb_nodes()/n : 1;
-        for (std::size_t i = 0; i < g.nb_nodes() ; i += incr) {
-            node u(i);
+        query_stats stats;
+        query.clear_stats();
+        for (std::size_t i = 0; i < n_queries; ++i) {
+            node u(rnd_node(rng)), v(rnd_node(rng));
+            auto start = bench_clock::now();
+            query.distance(u, v);
+            stats.add(1000. * elapsed_ms(start), query.nb_settled());
+        }
+        std::cerr <<"random queries: "<< n_queries <<"\n";
+        std::cout <<"  \"random_queries\": ";
+        stats.json(std::cout, "  ");
+        std::cout <<",\n  \"random_queries_search\": ";
+        query.stats().json(std::cout); // with CH_STATS only
+        std::cout <<",\n";
+    }
+
+    // ---------------------- Dijkstra rank queries --------------
+    // For each source, the target of Dijkstra rank 2^r is the 2^r-th node
+    // settled by a Dijkstra from the source. Distances are checked.
+    {
+        query_stats dijkstra_stats;
+        std::vector<query_stats> by_rank;
+        for (std::size_t i = 0; i < n_sources; ++i) {
+            node u(rnd_node(rng));
+            auto start = bench_clock::now();
             trav.dijkstra(g, u);
+            const std::vector<node> & settled = trav.settled_nodes();
+            dijkstra_stats.add(1000. * elapsed_ms(start), settled.size());
+            for (std::size_t r = 1; (std::size_t(1) << r) <= settled.size();
+                 ++r) {
+                if (by_rank.size() < r) { by_rank.resize(r); }
+                node v = settled[(std::size_t(1) << r) - 1];
+                start = bench_clock::now();
+                dist d = query.distance(u, v);
+                by_rank[r-1].add(1000. * elapsed_ms(start), query.nb_settled());
+                if (d != trav.distance(v)) { ++(by_rank[r-1].errors); }
+            }
+        }
+        std::cerr <<"Dijkstra rank queries: "<< n_sources <<" sources\n";
+        std::cout <<"  \"dijkstra_one_to_all\": ";
+        dijkstra_stats.json(std::cout, "  ");
+        std::cout <<",\n  \"dijkstra_rank_queries\": [";
+        for (std::size_t r = 1; r <= by_rank.size(); ++r) {
+            std::cout << (r > 1 ? "," : "") <<"\n    {\"rank\": "
+                      << (std::size_t(1) << r) <<", \"queries\": ";
+            by_rank[r-1].json(std::cout, "    ");
+            std::cout <<"}";
         }
-        auto stop = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast
-            <std::chrono::milliseconds>(stop - start);
-        std::cerr << n <<" x "<< n  <<" pairs: "<< duration.count() <<" ms\n";
+        std::cout <<"\n  ],\n";
     }
 
+    // ------------------------- hub labels ----------------------
+    if (run("hub_labels")) {
+        auto start = bench_clock::now();
+        hub_labels hl(query);
+        double ms = elapsed_ms(start);
+        query_stats stats;
+        for (std::size_t i = 0; i < n_queries; ++i) {
+            node u(rnd_node(rng)), v(rnd_node(rng));
+            start = bench_clock::now();
+            dist d = hl.distance(u, v);
+            stats.add(1000. * elapsed_ms(start),
+                      hl.forward_label_size(u) + hl.backward_label_size(v));
+            if (d != query.distance(u, v)) { ++stats.errors; }
+        }
+        std::cerr <<"hub labels: "<< hl.nb_entries() <<" entries\n";
+        std::cout <<"  \"hub_labels\": {\"ms\": "<< ms
+                  <<", \"entries\": "<< hl.nb_entries()
+                  <<", \"avg_label_size\": "
+                  << hl.nb_entries() / (2. * hl.nb_nodes())
+                  <<", \"peak_memory_kb\": "<< peak_memory_kb()
+                  <<",\n   \"queries\": ";
+        stats.json(std::cout, "   "); // settled: label entries scanned
+        std::cout <<"},\n";
+    }
 
-    // Distance oracle with contraction hierarchies.
-    
-    contraction contr(g);
-    digraph g_ch = contr.contract();
-    std::cout <<"contraction : n="<< g_ch.nb_nodes()
-              <<" m="<< g_ch.nb_edges() <<"\n";
-        
-    // Check distances:
-    auto start = std::chrono::high_resolution_clock::now();
-    traversal trav;
-    std::size_t n = std::min(std::size_t(n_nodes), g.nb_nodes());
+    // ------------------------- one-to-many ---------------------
+    std::vector<node> nodes;
+    const std::size_t n = std::min(n_pairs, g.nb_nodes());
     const std::size_t incr = g.nb_nodes() > n ? g.nb_nodes()/n : 1;
     for (std::size_t i = 0; i < g.nb_nodes() ; i += incr) {
-        node u(i);
-        for (std::size_t j = 0; j < g.nb_nodes() ; j += incr) {
-            node v(j);
-            contr.distance(u, v);
+        nodes.push_back(node(i));
+    }
+    const double n_nodes_pairs = double(nodes.size()) * nodes.size();
+    std::cout <<"  \"pairs\": "<< nodes.size() <<",\n";
+
+    // Same pairs spread over a pool of threads sharing the index:
+    if (run("pool_queries")) {
+        std::vector<std::pair<node, node>> queries;
+        for (node u : nodes) {
+            for (node v : nodes) { queries.emplace_back(u, v); }
         }
+        ch_query_pool pool(contr.query_index());
+        auto start = bench_clock::now();
+        pool.distances(queries);
+        std::cout <<"  \"pool_queries\": {\"threads\": "<< pool.nb_threads()
+                  <<", \"ms\": "<< elapsed_ms(start) <<"},\n";
     }
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast
-        <std::chrono::milliseconds>(stop - start);
-    std::cerr << n <<" x "<< n  <<" CH queries: "<< duration.count() <<" ms\n";
 
-}
-        
+    // Path unpacking, without and with cached unpacking of the upper half
+    // of the hierarchy:
+    if (run("path_queries")) {
+        for (bool cached : {false, true}) {
+            if (cached) { contr.cache_unpacked_shortcuts(g.nb_nodes() / 2); }
+            std::size_t path_nodes = 0;
+            auto start = bench_clock::now();
+            for (node u : nodes) {
+                for (node v : nodes) { path_nodes += contr.path(u, v).size(); }
+            }
+            std::cout <<"  \"path_queries"<< (cached ? "_cached" : "")
+                      <<"\": {\"ms\": "<< elapsed_ms(start)
+                      <<", \"avg_nodes\": "<< path_nodes / n_nodes_pairs
+                      <<"},\n";
+        }
+    }
+
+    // Bucket algorithm:
+    if (run("distance_table")) {
+        auto start = bench_clock::now();
+        std::vector<dist> table = contr.distance_table(nodes, nodes);
+        std::cout <<"  \"distance_table\": {\"ms\": "<< elapsed_ms(start)
+                  <<"},\n";
+    }
+
+    // One-to-all with PHAST, one source at a time and by batches:
+    if (run("phast")) {
+        phast ph(contr.query_engine());
+        auto start = bench_clock::now();
+        for (node u : nodes) { ph.one_to_all(u); }
+        double ms = elapsed_ms(start);
+        start = bench_clock::now();
+        for (std::size_t b = 0; b < nodes.size(); b += phast::lanes) {
+            std::size_t e = std::min(nodes.size(), b + phast::lanes);
+            ph.one_to_all_batch(std::vector<node>(nodes.begin() + b,
+                                                  nodes.begin() + e));
+        }
+        std::cout <<"  \"phast\": {\"ms\": "<< ms
+                  <<", \"batch_ms\": "<< elapsed_ms(start)
+                  <<", \"lanes\": "<< phast::lanes <<"},\n";
+    }
+
+    // RPHAST from the same sources to the pair nodes as targets, with and
+    // without a limit (median distance of the first source):
+    if (run("rphast")) {
+        auto start = bench_clock::now();
+        rphast rph(contr.query_engine(), nodes);
+        double select_ms = elapsed_ms(start);
+        start = bench_clock::now();
+        for (node u : nodes) { rph.one_to_many(u); }
+        double ms = elapsed_ms(start);
+        rph.one_to_many(nodes[0]);
+        std::vector<dist> d;
+        for (std::size_t k = 0; k < nodes.size(); ++k) {
+            d.push_back(rph.distance(k));
+        }
+        std::sort(d.begin(), d.end());
+        const dist limit = d[d.size() / 2];
+        start = bench_clock::now();
+        std::size_t within = 0;
+        for (node u : nodes) { within += rph.isochrone(u, limit).size(); }
+        std::cout <<"  \"rphast\": {\"targets\": "<< nodes.size()
+                  <<", \"restricted\": "<< rph.restricted_size()
+                  <<", \"select_ms\": "<< select_ms
+                  <<", \"ms\": "<< ms
+                  <<", \"bounded_ms\": "<< elapsed_ms(start)
+                  <<", \"avg_within\": "<< within / nodes.size() <<"},\n";
+    }
+
+    // 10 nearest of targets spread over the graph, from the pair nodes,
+    // then moving each target once:
+    if (run("knn")) {
+        knn_index knn(contr.query_engine());
+        const std::size_t nb_targets = std::min(std::size_t(20000),
+                                                g.nb_nodes());
+        std::vector<knn_index::target_t> targets;
+        auto start = bench_clock::now();
+        for (std::size_t i = 0; i < nb_targets; ++i) {
+            targets.push_back(knn.add_target(node(rnd_node(rng))));
+        }
+        double insert_ms = elapsed_ms(start);
+        start = bench_clock::now();
+        std::size_t found = 0;
+        for (node u : nodes) { found += knn.nearest(u, 10).size(); }
+        double query_ms = elapsed_ms(start);
+        start = bench_clock::now();
+        for (knn_index::target_t t : targets) {
+            knn.move_target(t, node(rnd_node(rng)));
+        }
+        std::cout <<"  \"knn\": {\"targets\": "<< nb_targets
+                  <<", \"k\": 10, \"bucket_entries\": "
+                  << knn.nb_bucket_entries()
+                  <<", \"insert_ms\": "<< insert_ms
+                  <<", \"query_ms\": "<< query_ms
+                  <<", \"queries\": "<< nodes.size()
+                  <<", \"avg_found\": "<< double(found) / nodes.size()
+                  <<", \"move_ms\": "<< elapsed_ms(start) <<"},\n";
+    }
+
+    // Partial hierarchy (average degree 4 in the core), queried with plain
+    // searches and with a core table (if the core is small enough), on
+    // random pairs:
+    if (run("partial_hierarchy")) {
+        contraction partial(g);
+        auto start = bench_clock::now();
+        partial.contract(4.f);
+        double prepro_ms = elapsed_ms(start);
+        ch_query plain(partial.query_index()), core(partial.query_index());
+        const std::size_t core_size = core.index()->core_size();
+        const bool with_table = core_size <= core_table::max_core_size;
+        std::shared_ptr<core_table> table;
+        double table_ms = 0;
+        if (with_table) {
+            start = bench_clock::now();
+            table = std::make_shared<core_table>(*core.index());
+            table_ms = elapsed_ms(start);
+            core.set_core_table(table);
+        }
+        query_stats plain_stats, core_stats;
+        for (std::size_t i = 0; i < n_queries; ++i) {
+            node u(rnd_node(rng)), v(rnd_node(rng));
+            start = bench_clock::now();
+            dist d = plain.distance(u, v);
+            plain_stats.add(1000. * elapsed_ms(start), plain.nb_settled());
+            if ( ! with_table) continue;
+            start = bench_clock::now();
+            if (core.distance(u, v) != d) { ++core_stats.errors; }
+            core_stats.add(1000. * elapsed_ms(start), core.nb_settled());
+        }
+        std::cerr <<"partial hierarchy: core of "<< core_size <<" nodes"
+                  << (with_table ? "" : " (no table)") <<"\n";
+        std::cout <<"  \"partial_hierarchy\": {\"max_avg_deg\": 4"
+                  <<", \"ms\": "<< prepro_ms
+                  <<", \"core_nodes\": "<< core_size;
+        if (with_table) {
+            std::cout <<", \"table_ms\": "<< table_ms
+                      <<", \"table_bytes\": "<< table->memory_bytes();
+        }
+        std::cout <<",\n    \"plain_queries\": ";
+        plain_stats.json(std::cout, "    ");
+        if (with_table) {
+            std::cout <<",\n    \"core_queries\": ";
+            core_stats.json(std::cout, "    ");
+        }
+        std::cout <<"},\n";
+    }
 
+    // Customizable CH: preprocessing, customization and queries:
+    if (run("cch")) {
+        auto start = bench_clock::now();
+        cch cc(g);
+        double prepro_ms = elapsed_ms(start);
+        std::vector<edge_len> lengths;
+        for (const edge & e : g.to_edges()) { lengths.push_back(e.len); }
+        start = bench_clock::now();
+        cc.customize(lengths);
+        double custom_ms = elapsed_ms(start);
+        start = bench_clock::now();
+        for (node u : nodes) {
+            for (node v : nodes) { cc.distance(u, v); }
+        }
+        std::cout <<"  \"cch\": {\"preprocessing_ms\": "<< prepro_ms
+                  <<", \"arcs\": "<< cc.nb_arcs()
+                  <<", \"height\": "<< cc.elimination_tree_height()
+                  <<", \"customization_ms\": "<< custom_ms
+                  <<", \"queries_ms\": "<< elapsed_ms(start) <<"},\n";
+    }
+
+    std::cout <<"  \"peak_memory_kb\": "<< peak_memory_kb() <<"\n}\n";
+}
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "cch.hh"
+#include "parallel.hh"
+#include "traversal.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+// Nested dissection with separators from BFS layers.
+struct nested_dissection {
+    static constexpr std::size_t leaf_size = 8;
+    static constexpr std::uint_least32_t separated = 0; // part of separators
+
+    const std::vector<std::vector<node>> & adj; // undirected
+    std::vector<std::uint_least32_t> part, seen, level;
+    std::uint_least32_t nb_parts, stamp;
+    std::vector<node> order;
+
+    nested_dissection(const std::vector<std::vector<node>> & adj)
+        : adj(adj), part(adj.size(), 1), seen(adj.size(), 0),
+          level(adj.size(), 0), nb_parts(1), stamp(0) {}
+
+    // Nodes of part [p] reachable from [s] in BFS order, with their level.
+    std::vector<node> bfs(node s, std::uint_least32_t p) {
+        std::vector<node> visit;
+        ++stamp;
+        seen[s] = stamp;
+        level[s] = 0;
+        visit.push_back(s);
+        for (std::size_t i = 0; i < visit.size(); ++i) {
+            node u = visit[i];
+            for (node v : adj[u]) {
+                if (part[v] == p && seen[v] != stamp) {
+                    seen[v] = stamp;
+                    level[v] = level[u] + 1;
+                    visit.push_back(v);
+                }
+            }
+        }
+        return visit;
+    }
+
+    // Connected components of the nodes of part [p] in [nodes], each
+    // gets a new part.
+    std::vector<std::vector<node>> components(const std::vector<node> & nodes,
+                                              std::uint_least32_t p) {
+        std::vector<std::vector<node>> comps;
+        for (node u : nodes) {
+            if (part[u] != p) continue;
+            comps.push_back(bfs(u, p));
+            ++nb_parts;
+            for (node v : comps.back()) { part[v] = nb_parts; }
+        }
+        return comps;
+    }
+
+    // Append [nodes] (connected and forming a part) to [order], separator
+    // last.
+    void dissect(const std::vector<node> & nodes) {
+        if (nodes.size() <= leaf_size) {
+            order.insert(order.end(), nodes.begin(), nodes.end());
+            return;
+        }
+        const std::uint_least32_t p = part[nodes[0]];
+        // BFS layers from a pseudo-peripheral node:
+        std::vector<node> visit = bfs(bfs(nodes[0], p).back(), p);
+        assert(visit.size() == nodes.size());
+        const std::size_t nlev = level[visit.back()] + 1;
+        // Nodes of layer l adjacent to layer l+1 separate the layers before
+        // and after them:
+        std::vector<std::size_t> count(nlev, 0), boundary(nlev, 0);
+        for (node u : visit) {
+            ++count[level[u]];
+            for (node v : adj[u]) {
+                if (part[v] == p && level[v] == level[u] + 1) {
+                    ++boundary[level[u]];
+                    break;
+                }
+            }
+        }
+        // Smallest boundary with a balanced cut (or the median layer):
+        const std::size_t n = nodes.size();
+        std::size_t best = nlev, before = 0;
+        for (std::size_t l = 0; l + 1 < nlev; ++l) {
+            before += count[l];
+            if (best == nlev && 2 * before >= n) { best = l; }
+            if (3 * before >= n && 3 * before <= 2 * n
+                && (best == nlev || boundary[l] < boundary[best])) {
+                best = l;
+            }
+        }
+        if (best == nlev) { best = nlev - 2; }
+        std::vector<node> sep;
+        for (node u : visit) {
+            if (level[u] != best) continue;
+            for (node v : adj[u]) {
+                if (part[v] == p && level[v] == best + 1) {
+                    sep.push_back(u);
+                    break;
+                }
+            }
+        }
+        for (node u : sep) { part[u] = separated; }
+        for (const std::vector<node> & comp : components(nodes, p)) {
+            dissect(comp);
+        }
+        order.insert(order.end(), sep.begin(), sep.end());
+    }
+};
+
+void cch::dissection_order(const digraph & g) {
+    const std::size_t n = g.nb_nodes();
+    std::vector<std::vector<node>> adj(n);
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) {
+            if (e.dst == u) continue;
+            adj[u].push_back(e.dst);
+            adj[e.dst].push_back(u);
+        }
+    }
+    for (auto & a : adj) {
+        std::sort(a.begin(), a.end());
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+    }
+    nested_dissection nd(adj);
+    std::vector<node> all;
+    for (node u : g) { all.push_back(u); }
+    for (const std::vector<node> & comp : nd.components(all, 1)) {
+        nd.dissect(comp);
+    }
+    order = std::move(nd.order);
+}
+
+cch::cch(const digraph & g, std::size_t nb_threads)
+    : nb_threads(nb_threads > 0 ? nb_threads
+                 : std::max(1u, std::thread::hardware_concurrency()))
+{
+    const std::size_t n = g.nb_nodes();
+    dissection_order(g);
+    assert(order.size() == n);
+    rank.resize(n);
+    for (std::size_t r = 0; r < n; ++r) { rank[order[r]] = rank_t(r); }
+
+    // Chordal supergraph: when eliminating r, its upward neighbors get
+    // linked to its parent, its lowest upward neighbor.
+    std::vector<std::vector<rank_t>> up(n);
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) {
+            rank_t ru = rank[u], rv = rank[e.dst];
+            if (ru < rv) { up[ru].push_back(rv); }
+            if (rv < ru) { up[rv].push_back(ru); }
+        }
+    }
+    parent.assign(n, rank_t(n));
+    up_offsets.reserve(n + 1);
+    up_offsets.push_back(0);
+    for (std::size_t r = 0; r < n; ++r) {
+        std::vector<rank_t> & ur = up[r];
+        std::sort(ur.begin(), ur.end());
+        ur.erase(std::unique(ur.begin(), ur.end()), ur.end());
+        if ( ! ur.empty()) {
+            parent[r] = ur[0];
+            up[ur[0]].insert(up[ur[0]].end(), ur.begin() + 1, ur.end());
+        }
+        up_heads.insert(up_heads.end(), ur.begin(), ur.end());
+        up_offsets.push_back(up_heads.size());
+        std::vector<rank_t>().swap(ur);
+    }
+
+    // Arcs grouped by head (counting sort):
+    down_offsets.assign(n + 1, 0);
+    for (rank_t h : up_heads) { ++down_offsets[h + 1]; }
+    for (std::size_t r = 0; r < n; ++r) { down_offsets[r+1] += down_offsets[r]; }
+    down_arcs.resize(up_heads.size());
+    {
+        std::vector<std::size_t> pos(down_offsets.begin(), down_offsets.end() - 1);
+        for (std::size_t r = 0; r < n; ++r) {
+            for (std::size_t i = up_offsets[r]; i < up_offsets[r+1]; ++i) {
+                down_arcs[pos[up_heads[i]]++] = { rank_t(r), i };
+            }
+        }
+    }
+
+    // Ranks by height in the elimination tree:
+    std::vector<std::size_t> height(n, 0);
+    std::size_t max_height = 0;
+    for (std::size_t r = 0; r < n; ++r) {
+        if (parent[r] < n) {
+            height[parent[r]] = std::max(height[parent[r]], height[r] + 1);
+        }
+        max_height = std::max(max_height, height[r] + 1);
+    }
+    height_offsets.assign(max_height + 1, 0);
+    for (std::size_t h : height) { ++height_offsets[h + 1]; }
+    for (std::size_t h = 0; h < max_height; ++h) {
+        height_offsets[h+1] += height_offsets[h];
+    }
+    height_ranks.resize(n);
+    {
+        std::vector<std::size_t> pos(height_offsets.begin(),
+                                     height_offsets.end() - 1);
+        for (std::size_t r = 0; r < n; ++r) {
+            height_ranks[pos[height[r]]++] = rank_t(r);
+        }
+    }
+
+    // Arc of each original edge:
+    const std::uint64_t no_arc = std::numeric_limits<std::uint64_t>::max();
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) {
+            rank_t ru = rank[u], rv = rank[e.dst];
+            if (ru == rv) { edge_arc.push_back(no_arc); continue; } // loop
+            rank_t lo = std::min(ru, rv), hi = std::max(ru, rv);
+            auto beg = up_heads.begin() + up_offsets[lo];
+            auto it = std::lower_bound(beg, up_heads.begin() + up_offsets[lo+1],
+                                       hi);
+            assert(*it == hi);
+            edge_arc.push_back(2 * std::uint64_t(it - up_heads.begin())
+                               + (ru > rv ? 1 : 0));
+        }
+    }
+
+    fwd_dist.assign(n, infinity);
+    bwd_dist.assign(n, infinity);
+    std::vector<edge_len> lengths;
+    lengths.reserve(edge_arc.size());
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) { lengths.push_back(e.len); }
+    }
+    customize(lengths);
+}
+
+void cch::customize(const std::vector<edge_len> & lengths) {
+    CHECK(lengths.size() == edge_arc.size());
+    fwd_len.assign(nb_arcs(), infinity);
+    bwd_len.assign(nb_arcs(), infinity);
+    for (std::size_t i = 0; i < lengths.size(); ++i) {
+        const std::uint64_t a = edge_arc[i];
+        if (a == std::numeric_limits<std::uint64_t>::max()) continue;
+        std::uint_least32_t & l = (a & 1) ? bwd_len[a >> 1] : fwd_len[a >> 1];
+        l = std::min(l, std::uint_least32_t(lengths[i]));
+    }
+    // Heights bottom-up, small ones are customized sequentially:
+    for (std::size_t h = 0; h + 1 < height_offsets.size(); ++h) {
+        const std::size_t beg = height_offsets[h], end = height_offsets[h+1];
+        if (end - beg < 256 || nb_threads == 1) {
+            for (std::size_t i = beg; i < end; ++i) {
+                customize_node(height_ranks[i]);
+            }
+        } else {
+            parallel_for(end - beg, nb_threads, [this, beg](std::size_t i,
+                                                            std::size_t) {
+                    customize_node(height_ranks[beg + i]);
+                });
+        }
+    }
+}
+
+void cch::customize_node(rank_t x) {
+    for (std::size_t d = down_offsets[x]; d < down_offsets[x+1]; ++d) {
+        const rank_t z = down_arcs[d].tail;
+        const std::size_t zx = down_arcs[d].arc;
+        const std::uint_least32_t l_xz = bwd_len[zx], l_zx = fwd_len[zx];
+        if (l_xz == infinity && l_zx == infinity) continue;
+        // Upward neighbors y of z above x are upward neighbors of x:
+        std::size_t xy = up_offsets[x];
+        for (std::size_t zy = zx + 1; zy < up_offsets[z+1]; ++zy) {
+            while (up_heads[xy] != up_heads[zy]) { ++xy; }
+            assert(xy < up_offsets[x+1]);
+            fwd_len[xy] = std::min(fwd_len[xy], sat_add(fwd_len[zy], l_xz));
+            bwd_len[xy] = std::min(bwd_len[xy], sat_add(bwd_len[zy], l_zx));
+        }
+    }
+}
+
+dist cch::distance(node src, node dst) {
+    const rank_t nil = rank_t(nb_nodes());
+    auto relax = [this](rank_t x, std::vector<std::uint_least32_t> & d,
+                        const std::vector<std::uint_least32_t> & len) {
+        const std::uint_least32_t dx = d[x];
+        if (dx == infinity) return; // not reached
+        for (std::size_t i = up_offsets[x]; i < up_offsets[x+1]; ++i) {
+            const rank_t y = up_heads[i];
+            d[y] = std::min(d[y], sat_add(dx, len[i]));
+        }
+    };
+    rank_t s = rank[src], t = rank[dst];
+    fwd_dist[s] = 0;
+    bwd_dist[t] = 0;
+    // Ancestors of only one of them:
+    while (s != t) {
+        if (s < t) { relax(s, fwd_dist, fwd_len); s = parent[s]; }
+        else { relax(t, bwd_dist, bwd_len); t = parent[t]; }
+    }
+    // Common ancestors:
+    std::uint_least32_t best = infinity;
+    for ( ; s != nil; s = parent[s]) {
+        relax(s, fwd_dist, fwd_len);
+        relax(s, bwd_dist, bwd_len);
+        best = std::min(best, sat_add(fwd_dist[s], bwd_dist[s]));
+    }
+    for (s = rank[src]; s != nil; s = parent[s]) { fwd_dist[s] = infinity; }
+    for (t = rank[dst]; t != nil; t = parent[t]) { bwd_dist[t] = infinity; }
+    return dist(best);
+}
+
+
+
+namespace unit {
+
+    void test_cch() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            auto start = std::chrono::high_resolution_clock::now();
+            cch c(g);
+            auto stop = std::chrono::high_resolution_clock::now();
+            std::cout <<"cch: n="<< c.nb_nodes() <<" arcs="<< c.nb_arcs()
+                      <<" height="<< c.elimination_tree_height()
+                      <<" in "<< std::chrono::duration_cast
+                <std::chrono::milliseconds>(stop - start).count() <<"ms\n";
+            std::vector<node> order = c.contraction_order();
+            std::sort(order.begin(), order.end());
+            for (node u : g) { CHECK(order[u] == u); }
+
+            const std::size_t incr = std::max(std::size_t(1), g.n() / 20);
+            auto check_distances = [&c, incr](const digraph & h) {
+                traversal<digraph> trav;
+                for (std::size_t i = 0; i < h.n(); i += incr) {
+                    node u(i);
+                    trav.dijkstra(h, u);
+                    for (std::size_t j = 0; j < h.n(); j += incr / 3 + 1) {
+                        node v(j);
+                        CHECK(c.distance(u, v) == trav.distance(v));
+                    }
+                }
+            };
+            check_distances(g);
+
+            // Customize with other lengths:
+            std::vector<edge> edges = g.to_edges();
+            std::vector<edge_len> lengths;
+            digraph h;
+            for (std::size_t i = 0; i < edges.size(); ++i) {
+                edge e = edges[i];
+                e.len = edge_len(std::uint_least32_t(e.len) * (1 + i % 3)
+                                 + i % 7);
+                lengths.push_back(e.len);
+                h.add(e);
+            }
+            start = std::chrono::high_resolution_clock::now();
+            c.customize(lengths);
+            stop = std::chrono::high_resolution_clock::now();
+            std::cout <<"cch: customization in "<< std::chrono::duration_cast
+                <std::chrono::milliseconds>(stop - start).count() <<"ms\n";
+            check_distances(h);
+        }
+    }
+
+}
+
+}
@@ -0,0 +1,102 @@
+// Customizable contraction hierarchies (CCH).
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+#include "digraph.hh"
+
+namespace ch {
+
+/** The contraction order only depends on the topology of the graph: it is
+ * obtained by nested dissection, the nodes of a small separator are ranked
+ * after the nodes of the parts it separates, which are ordered recursively.
+ * Contracting the nodes in that order without witness searches gives a
+ * chordal supergraph of the (undirected) graph, computed once. Its arcs
+ * u->v with rank[u] < rank[v] are stored with two lengths, for u->v and
+ * v->u.
+ *
+ * Lengths can then be changed by customize(): arcs get the lengths of the
+ * original edges, and each arc x->y is improved through all its lower
+ * triangles x->z->y (z lower than x and y) in a bottom-up pass. An arc only
+ * depends on arcs from nodes below it in the elimination tree (the parent
+ * of a node is its lowest upward neighbor), the nodes of a same height in
+ * the tree are thus customized in parallel.
+ *
+ * The upward search space of a node is the path to the root from that node
+ * in the elimination tree: queries scan it without priority queue, in both
+ * directions from the source and the target.
+ */
+class cch {
+
+public:
+    using rank_t = std::uint_least32_t;
+    static constexpr auto dist_infinity = dist_max;
+
+protected:
+    // An arc z->x (z lower than x) stored with the arcs into x:
+    struct down_arc {
+        rank_t tail;
+        std::size_t arc;
+    };
+
+    std::vector<node> order; // node of each rank
+    std::vector<rank_t> rank; // rank of each node
+    std::vector<rank_t> parent; // in the elimination tree (n for roots)
+    // Upward arcs of each rank, sorted by head:
+    std::vector<std::size_t> up_offsets;
+    std::vector<rank_t> up_heads;
+    // Upward arcs grouped by head, sorted by tail:
+    std::vector<std::size_t> down_offsets;
+    std::vector<down_arc> down_arcs;
+    // Ranks grouped by height in the elimination tree:
+    std::vector<std::size_t> height_offsets;
+    std::vector<rank_t> height_ranks;
+    // Arc of each original edge: 2 * arc + 1 if it goes downward.
+    std::vector<std::uint64_t> edge_arc;
+    std::vector<std::uint_least32_t> fwd_len, bwd_len; // of each arc
+    std::size_t nb_threads;
+
+    // For queries (by rank):
+    std::vector<std::uint_least32_t> fwd_dist, bwd_dist;
+
+    // Order nodes of [g] by nested dissection.
+    void dissection_order(const digraph & g) ;
+
+    // Improve arcs from [x] through its lower triangles.
+    void customize_node(rank_t x) ;
+
+public:
+
+    // Metric-independent preprocessing of [g], which is then customized
+    // with the lengths of its edges. Customization uses [nb_threads]
+    // threads (0 means one per hardware thread).
+    explicit cch(const digraph & g, std::size_t nb_threads = 0) ;
+
+    // Set the length of the i-th edge of the graph to [lengths[i]],
+    // edges being numbered as in digraph::to_edges().
+    void customize(const std::vector<edge_len> & lengths) ;
+
+    dist distance(node src, node dst) ;
+
+    std::size_t nb_nodes() const { return order.size(); }
+
+    // Number of arcs of the chordal supergraph (each with two lengths).
+    std::size_t nb_arcs() const { return up_heads.size(); }
+
+    // Height of the elimination tree (maximum number of nodes scanned in
+    // one direction by a query).
+    std::size_t elimination_tree_height() const {
+        return height_offsets.size() - 1;
+    }
+
+    // Returns the nodes ordered by rank.
+    const std::vector<node> & contraction_order() const { return order; }
+};
+
+namespace unit {
+    void test_cch();
+}
+
+}
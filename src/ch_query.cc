@@ -0,0 +1,467 @@
+#include <algorithm>
+
+#include "ch_query.hh"
+#include "core_table.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+// Upward edges of [g] according to [rank] in internal ids: [ext] gives
+// the node of [g] of each internal id and [intl] the converse. Heads are
+// sorted by rank.
+static static_digraph upward_graph(const digraph & g,
+                                   const std::vector<std::size_t> & rank,
+                                   const std::vector<node> & ext,
+                                   const std::vector<node> & intl) {
+    digraph up;
+    if (g.nb_nodes() > 0) { up.add_node(node(g.nb_nodes() - 1u)); }
+    std::vector<edge_head> hds;
+    for (std::size_t i = 0; i < ext.size(); ++i) {
+        const node u = ext[i];
+        hds.clear();
+        for (auto e : g.out_neighbors(u)) {
+            if (rank[u] <= rank[e.dst] && u != e.dst) {
+                hds.push_back(edge_head(intl[e.dst], e.len));
+            }
+        }
+        std::sort(hds.begin(), hds.end(), [&rank, &ext](edge_head a,
+                                                          edge_head b) {
+                return rank[ext[a.dst]] < rank[ext[b.dst]];
+            });
+        for (auto e : hds) { up.add_edge(node(i), e); }
+    }
+    return static_digraph(up);
+}
+
+ch_index::ch_index(const digraph & fwd, const digraph & bwd,
+                   const std::vector<std::size_t> & rank)
+{
+    assert(fwd.nb_nodes() == rank.size() && bwd.nb_nodes() == rank.size());
+    const std::size_t n = rank.size();
+    // Internal ids by decreasing rank:
+    std::vector<node> ext, intl(n);
+    for (std::size_t u = 0; u < n; ++u) { ext.push_back(node(u)); }
+    std::stable_sort(ext.begin(), ext.end(), [&rank](node u, node v) {
+            return rank[u] > rank[v];
+        });
+    std::vector<rank_t> rk(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        intl[ext[i]] = node(i);
+        rk[i] = rank_t(rank[ext[i]]);
+    }
+    this->rank = frozen_array<rank_t>(std::move(rk));
+    up_fwd = upward_graph(fwd, rank, ext, intl);
+    up_bwd = upward_graph(bwd, rank, ext, intl);
+    to_internal = frozen_array<node>(std::move(intl));
+    to_external = frozen_array<node>(std::move(ext));
+}
+
+ch_index::ch_index(frozen_array<rank_t> rank,
+                   static_digraph up_fwd, static_digraph up_bwd,
+                   frozen_array<node> to_internal,
+                   frozen_array<node> to_external)
+    : rank(std::move(rank)), up_fwd(std::move(up_fwd)),
+      up_bwd(std::move(up_bwd)), to_internal(std::move(to_internal)),
+      to_external(std::move(to_external))
+{
+    const std::size_t n = this->rank.size();
+    CHECK(this->up_fwd.nb_nodes() == n && this->up_bwd.nb_nodes() == n);
+    CHECK(this->to_internal.size() == this->to_external.size()
+          && (this->to_internal.size() == 0 || this->to_internal.size() == n));
+}
+
+// Copy of [g] where edges i->j of [changed] (internal ids) have length
+// [len], all parallel edges i->j included.
+static static_digraph with_lengths(const static_digraph & g,
+                                   const std::vector<edge> & changed) {
+    std::vector<edge_head> hds(g.head_array().begin(), g.head_array().end());
+    const frozen_array<static_digraph::offset> & offsets = g.offset_array();
+    for (const edge & e : changed) {
+        bool found = false;
+        for (auto k = offsets[e.src]; k < offsets[std::size_t(e.src) + 1];
+             ++k) {
+            if (hds[k].dst == e.dst) { hds[k].len = e.len; found = true; }
+        }
+        CHECK(found);
+    }
+    return static_digraph(offsets, frozen_array<edge_head>(std::move(hds)));
+}
+
+ch_index::ch_index(const ch_index & ix, const std::vector<edge> & changed)
+    : rank(ix.rank), to_internal(ix.to_internal), to_external(ix.to_external)
+{
+    // Edge u->v is upward from u if rank[u] <= rank[v] and upward from v
+    // (reversed) if rank[u] >= rank[v], in both directions in the core:
+    std::vector<edge> fwd_changed, bwd_changed;
+    for (const edge & e : changed) {
+        const node i = internal(e.src), j = internal(e.dst);
+        if (rank[i] <= rank[j]) { fwd_changed.emplace_back(i, j, e.len); }
+        if (rank[i] >= rank[j]) { bwd_changed.emplace_back(j, i, e.len); }
+    }
+    up_fwd = with_lengths(ix.up_fwd, fwd_changed);
+    up_bwd = with_lengths(ix.up_bwd, bwd_changed);
+}
+
+std::size_t ch_index::core_size() const {
+    std::size_t c = 0;
+    while (c < rank.size() && rank[c] == rank[0]) { ++c; }
+    return c > 1 ? c : 0;
+}
+
+ch_query::ch_query(std::shared_ptr<const ch_index> index)
+    : idx(std::move(index)) {}
+
+ch_query::ch_query(const digraph & fwd, const digraph & bwd,
+                   const std::vector<std::size_t> & rank)
+    : idx(std::make_shared<ch_index>(fwd, bwd, rank)) {}
+
+ch_query::ch_query(frozen_array<rank_t> rank,
+                   static_digraph up_fwd, static_digraph up_bwd,
+                   frozen_array<node> to_internal,
+                   frozen_array<node> to_external)
+    : idx(std::make_shared<ch_index>(std::move(rank), std::move(up_fwd),
+                                     std::move(up_bwd), std::move(to_internal),
+                                     std::move(to_external))) {}
+
+void ch_query::upward_search::start(std::size_t n, node src) {
+    init(n);
+    if (parents.size() < n) { parents.resize(n); }
+    distances[src] = 0;
+    parents[src] = src;
+    queue.push(src, 0);
+    CH_STAT(++counters.pushes);
+}
+
+dist ch_query::upward_search::min_dist() {
+    while ( ! queue.empty() && visited[queue.top()._node]) {
+        queue.pop();
+        CH_STAT(++counters.stale_pops);
+    }
+    return queue.empty() ? dist(dist_infinity) : queue.top()._dist;
+}
+
+node_dist ch_query::upward_search::settle_next(const static_digraph & up,
+                                               const static_digraph & down,
+                                               bool & stalled,
+                                               std::size_t core_end) {
+    node_dist ud = queue.top();
+    queue.pop();
+    node u = ud._node;
+    dist du = ud._dist;
+    assert( ! visited[u] && du == distances[u]);
+    visited[u] = true;
+    visited_nodes.push_back(u);
+    CH_STAT(++counters.settled);
+    // stall-on-demand:
+    for (auto e : down.out_neighbors(u)) {
+        dist dw = distances[e.dst];
+        if (dw < dist_infinity && dw + dist(e.length()) < du) {
+            stalled = true;
+            return ud;
+        }
+    }
+    stalled = false;
+    if (u < core_end) return ud; // an entry point of the core
+    for (auto e : up.out_neighbors(u)) {
+        CH_STAT(++counters.relaxed);
+        node v = e.head();
+        dist dv = du + dist(e.length());
+        if (dv < distances[v]) {
+            distances[v] = dv;
+            parents[v] = u;
+            queue.push(v, dv);
+            CH_STAT(++counters.pushes);
+        }
+    }
+    return ud;
+}
+
+// Update [best] and [meeting] if [ud] was also reached by [oth].
+static inline void meet(node_dist ud, const traversal<static_digraph> & oth,
+                        dist & best, node & meeting) {
+    dist d_oth = oth.distance(ud._node);
+    if (d_oth < dist_max && ud._dist + d_oth < best) {
+        best = ud._dist + d_oth;
+        meeting = ud._node;
+    }
+}
+
+void ch_query::set_core_table(std::shared_ptr<const core_table> table) {
+    CHECK( ! table || table->core_size() == idx->core_size());
+    core = std::move(table);
+}
+
+dist ch_query::distance(node src, node dst) {
+    return core ? core_distance(src, dst) : hierarchy_distance(src, dst);
+}
+
+dist ch_query::hierarchy_distance(node src, node dst) {
+    fwd_search.start(nb_nodes(), idx->internal(src));
+    bwd_search.start(nb_nodes(), idx->internal(dst));
+    dist best = dist_infinity;
+    bool stalled;
+    while (true) {
+        dist fwd_min = fwd_search.min_dist(), bwd_min = bwd_search.min_dist();
+        if (std::min(fwd_min, bwd_min) >= best) break; // also when both empty
+        if (fwd_min <= bwd_min) {
+            meet(fwd_search.settle_next(upward_fwd(), upward_bwd(), stalled),
+                 bwd_search, best, meeting);
+        } else {
+            meet(bwd_search.settle_next(upward_bwd(), upward_fwd(), stalled),
+                 fwd_search, best, meeting);
+        }
+    }
+    return best;
+}
+
+dist ch_query::core_distance(node src, node dst) {
+    const core_table & table = *core;
+    const std::size_t c = table.core_size();
+    fwd_search.start(nb_nodes(), idx->internal(src));
+    bwd_search.start(nb_nodes(), idx->internal(dst));
+    core_fwd.clear();
+    core_bwd.clear();
+    dist best = dist_infinity;
+    bool stalled;
+    // As in hierarchy_distance(), a path through entry points a and b is
+    // at least d(src, a) + d(b, dst), so that the same stopping condition
+    // holds when each new entry point is joined with those of the other
+    // search:
+    while (true) {
+        dist fwd_min = fwd_search.min_dist(), bwd_min = bwd_search.min_dist();
+        if (std::min(fwd_min, bwd_min) >= best) break; // also when both empty
+        if (fwd_min <= bwd_min) {
+            node_dist ud = fwd_search.settle_next(upward_fwd(), upward_bwd(),
+                                                  stalled, c);
+            meet(ud, bwd_search, best, meeting);
+            if (ud._node < c && ! stalled) {
+                for (node_dist vd : core_bwd) {
+                    const dist d = table.distance(ud._node, vd._node);
+                    if (d < dist_infinity) {
+                        best = std::min(best, ud._dist + d + vd._dist);
+                    }
+                }
+                core_fwd.push_back(ud);
+            }
+        } else {
+            node_dist ud = bwd_search.settle_next(upward_bwd(), upward_fwd(),
+                                                  stalled, c);
+            meet(ud, fwd_search, best, meeting);
+            if (ud._node < c && ! stalled) {
+                for (node_dist vd : core_fwd) {
+                    const dist d = table.distance(vd._node, ud._node);
+                    if (d < dist_infinity) {
+                        best = std::min(best, vd._dist + d + ud._dist);
+                    }
+                }
+                core_bwd.push_back(ud);
+            }
+        }
+    }
+    return best;
+}
+
+std::vector<node> ch_query::hierarchy_path(node src, node dst) {
+    std::vector<node> path;
+    if (hierarchy_distance(src, dst) == dist_infinity) return path;
+    const node s = idx->internal(src), t = idx->internal(dst);
+    for (node u = meeting; u != s; u = fwd_search.parent(u)) {
+        path.push_back(idx->external(u));
+    }
+    path.push_back(src);
+    std::reverse(path.begin(), path.end());
+    for (node u = meeting; u != t; ) {
+        u = bwd_search.parent(u);
+        path.push_back(idx->external(u));
+    }
+    return path;
+}
+
+std::vector<dist>
+ch_query::distance_table(const std::vector<node> & sources,
+                         const std::vector<node> & targets) {
+    const std::size_t n = nb_nodes(), nt = targets.size();
+
+    // Buckets: one entry (target index, distance) per node settled by the
+    // backward search of each target, grouped by node (counting sort).
+    // Nodes are internal ids.
+    struct entry {
+        std::uint_least32_t target;
+        dist d;
+    };
+    std::vector<node_dist> settled; // node, distance
+    std::vector<std::uint_least32_t> settled_target;
+    for (std::size_t j = 0; j < nt; ++j) {
+        bwd_search.search_all(n, idx->internal(targets[j]), upward_bwd(),
+                              upward_fwd(),
+                              [&settled, &settled_target, j](node_dist vd) {
+                                  settled.push_back(vd);
+                                  settled_target.push_back(j);
+                              });
+    }
+    std::vector<std::size_t> bucket_offset(n + 1, 0);
+    for (node_dist vd : settled) { ++bucket_offset[vd._node + 1u]; }
+    for (std::size_t v = 0; v < n; ++v) {
+        bucket_offset[v+1] += bucket_offset[v];
+    }
+    std::vector<entry> buckets(settled.size());
+    {
+        std::vector<std::size_t> pos(bucket_offset.begin(),
+                                     bucket_offset.end() - 1);
+        for (std::size_t i = 0; i < settled.size(); ++i) {
+            buckets[pos[settled[i]._node]++] = { settled_target[i],
+                                                 settled[i]._dist };
+        }
+    }
+    settled = std::vector<node_dist>();
+    settled_target = std::vector<std::uint_least32_t>();
+
+    // Scan buckets of nodes settled by the forward search of each source:
+    std::vector<dist> table(sources.size() * nt, dist(dist_infinity));
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+        dist *row = table.data() + i * nt;
+        fwd_search.search_all(n, idx->internal(sources[i]), upward_fwd(),
+                              upward_bwd(),
+                              [row, &buckets, &bucket_offset](node_dist ud) {
+            const node u = ud._node;
+            for (std::size_t b = bucket_offset[u]; b < bucket_offset[u+1u]; ++b) {
+                dist d = ud._dist + buckets[b].d;
+                if (d < row[buckets[b].target]) { row[buckets[b].target] = d; }
+            }
+        });
+    }
+    return table;
+}
+
+ch_query_pool::ch_query_pool(std::shared_ptr<const ch_index> index,
+                             std::size_t nb_threads)
+    : idx(index),
+      contexts(nb_threads > 0 ? nb_threads
+               : std::max(1u, std::thread::hardware_concurrency()),
+               ch_query(index))
+{}
+
+std::vector<dist>
+ch_query_pool::distances(const std::vector<std::pair<node, node>> & queries) {
+    std::vector<dist> res(queries.size());
+    parallel_for(queries.size(), [&queries, &res](std::size_t i, ch_query & q) {
+            res[i] = q.distance(queries[i].first, queries[i].second);
+        });
+    return res;
+}
+
+namespace unit {
+
+    void test_ch_query() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            contraction contr(g);
+            digraph & g_ch = contr.contract();
+            ch_query q(g_ch, g_ch.reverse(), contr.contraction_ranks());
+            CHECK(q.nb_edges() == g_ch.nb_edges());
+            
+            traversal<digraph> trav;
+            const std::size_t incr = std::max(std::size_t(1), g.n() / 20);
+            std::size_t settled = 0, nq = 0;
+            for (std::size_t i = 0; i < g.n(); i += incr) {
+                node u(i);
+                trav.dijkstra(g, u);
+                for (std::size_t j = 0; j < g.n(); j += incr) {
+                    node v(j);
+                    CHECK(q.distance(u, v) == trav.distance(v));
+                    settled += q.nb_settled();
+                    ++nq;
+                }
+            }
+            // Internal ids are by decreasing rank:
+            const ch_index & ix = *q.index();
+            for (std::size_t i = 0; i < g.n(); ++i) {
+                CHECK(ix.internal(ix.external(node(i))) == node(i));
+                CHECK(i == 0 || ix.ranks()[i-1] >= ix.ranks()[i]);
+            }
+
+            // Hierarchy paths:
+            for (std::size_t i = 0; i < g.n(); i += incr) {
+                node u(i);
+                for (std::size_t j = 0; j < g.n(); j += incr) {
+                    node v(j);
+                    std::vector<node> p = q.hierarchy_path(u, v);
+                    if (q.distance(u, v) == dist_max) {
+                        CHECK(p.empty());
+                        continue;
+                    }
+                    CHECK(p.front() == u && p.back() == v);
+                    dist len = 0;
+                    for (std::size_t k = 0; k + 1 < p.size(); ++k) {
+                        dist l = dist_max;
+                        for (auto e : g_ch.out_neighbors(p[k])) {
+                            if (e.dst == p[k+1] && e.len < l) { l = e.len; }
+                        }
+                        CHECK(l < dist_max);
+                        len = len + l;
+                    }
+                    CHECK(len == q.distance(u, v));
+                }
+            }
+            std::cout <<"ch_query: n="<< g.n() <<" avg settled="
+                      << settled / nq <<"\n";
+
+            // Distance table:
+            std::vector<node> srcs, tgts;
+            for (std::size_t i = 0; i < g.n(); i += incr) {
+                srcs.push_back(node(i));
+            }
+            for (std::size_t j = incr / 2; j < g.n(); j += incr / 2 + 1) {
+                tgts.push_back(node(j));
+            }
+            std::vector<dist> table = q.distance_table(srcs, tgts);
+            CHECK(table.size() == srcs.size() * tgts.size());
+            for (std::size_t i = 0; i < srcs.size(); ++i) {
+                for (std::size_t j = 0; j < tgts.size(); ++j) {
+                    CHECK(table[i * tgts.size() + j]
+                          == q.distance(srcs[i], tgts[j]));
+                }
+            }
+
+            // Batch of queries on a shared index with a pool of threads,
+            // and concurrent contexts:
+            std::vector<std::pair<node, node>> queries;
+            for (node s : srcs) {
+                for (node t : tgts) { queries.emplace_back(s, t); }
+            }
+            ch_query_pool pool(q.index(), 3);
+            CHECK(pool.distances(queries) == table);
+            std::vector<dist> par(queries.size());
+            std::vector<std::thread> threads;
+            for (std::size_t t = 0; t < 2; ++t) {
+                threads.emplace_back([&q, &queries, &par, t]() {
+                        ch_query ctx(q.index());
+                        for (std::size_t i = t; i < queries.size(); i += 2) {
+                            par[i] = ctx.distance(queries[i].first,
+                                                  queries[i].second);
+                        }
+                    });
+            }
+            for (auto & th : threads) { th.join(); }
+            CHECK(par == table);
+
+            // Partial contraction: uncontracted nodes form a core searched
+            // in both directions.
+            contraction partial(g);
+            digraph & g_core = partial.contract(3);
+            ch_query pq(g_core, g_core.reverse(), partial.contraction_ranks());
+            for (std::size_t i = 0; i < g.n(); i += incr) {
+                node u(i);
+                trav.dijkstra(g, u);
+                for (std::size_t j = 0; j < g.n(); j += incr) {
+                    node v(j);
+                    CHECK(pq.distance(u, v) == trav.distance(v));
+                }
+            }
+            CHECK(pq.distance_table(srcs, tgts) == table);
+        }
+    }
+
+}
+
+}
@@ -0,0 +1,306 @@
+// Query engine for a contraction hierarchy (CH).
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+
+#include "basics.hh"
+#include "digraph.hh"
+#include "static_digraph.hh"
+#include "traversal.hh"
+#include "parallel.hh"
+
+namespace ch {
+
+/** Only upward edges are stored in each direction: edges u->v with
+ * rank[u] < rank[v] for the forward search, and edges u->v with
+ * rank[u] > rank[v] (reversed) for the backward search. Nodes that have
+ * not been contracted share the same maximal rank and all edges between
+ * them are kept in both directions, so that queries remain exact (but
+ * slower) with a partial contraction.
+ *
+ * The hierarchy is stored in a ch_index which is never modified: it can be
+ * shared by several threads, each querying it through its own ch_query
+ * which owns the buffers of the searches.
+ *
+ * Nodes are renumbered internally by decreasing rank, so that the top of
+ * the hierarchy, which all upward searches reach, is a small contiguous
+ * block of the arrays (uncontracted nodes come first). Node ids given to
+ * and returned by ch_query are the external ones (those of the contracted
+ * graph): ranks(), upward_fwd() and upward_bwd() use internal ids, see
+ * internal() and external().
+ */
+class ch_index {
+
+public:
+    using rank_t = std::uint_least32_t;
+
+protected:
+
+    frozen_array<rank_t> rank;
+    // up_fwd[u]: edges u->v upward; up_bwd[v]: edges v<-u upward (reversed).
+    // Each adjacency is sorted by increasing rank.
+    static_digraph up_fwd, up_bwd;
+    // Internal id of each external id and conversely (empty if identity):
+    frozen_array<node> to_internal, to_external;
+
+public:
+
+    ch_index() {}
+
+    // Index of hierarchy [fwd] (and its reverse [bwd]) where node u was
+    // contracted at rank [rank[u]] (uncontracted nodes must all have the
+    // same rank, greater than ranks of contracted nodes).
+    ch_index(const digraph & fwd, const digraph & bwd,
+             const std::vector<std::size_t> & rank) ;
+
+    // Index from its upward graphs and renumbering (e.g. as saved in a
+    // file), all in internal ids.
+    ch_index(frozen_array<rank_t> rank,
+             static_digraph up_fwd, static_digraph up_bwd,
+             frozen_array<node> to_internal = {},
+             frozen_array<node> to_external = {}) ;
+
+    // Copy of [ix] where each edge u->v of [changed] (external ids) has
+    // length [len] instead. Edges must be in [ix]: the structure is kept
+    // and only the edge arrays are copied (other arrays are shared).
+    ch_index(const ch_index & ix, const std::vector<edge> & changed) ;
+
+    node internal(node u) const {
+        return to_internal.size() == 0 ? u : to_internal[u];
+    }
+    node external(node i) const {
+        return to_external.size() == 0 ? i : to_external[i];
+    }
+    const frozen_array<node> & internal_ids() const { return to_internal; }
+    const frozen_array<node> & external_ids() const { return to_external; }
+
+    const frozen_array<rank_t> & ranks() const { return rank; }
+    const static_digraph & upward_fwd() const { return up_fwd; }
+    const static_digraph & upward_bwd() const { return up_bwd; }
+
+    std::size_t nb_nodes() const { return rank.size(); }
+
+    // Number of edges stored (in both directions).
+    std::size_t nb_edges() const { return up_fwd.nb_edges() + up_bwd.nb_edges(); }
+
+    // Number of uncontracted nodes of a partial hierarchy (the core), which
+    // are internal ids 0..core_size()-1, or 0 for a full hierarchy.
+    std::size_t core_size() const ;
+};
+
+class core_table;
+
+/** Query context for a ch_index. Both searches use stall-on-demand: a node
+ * u reached at distance du is not scanned if some node w with an edge
+ * w->u of length l going downward was reached at distance dw with
+ * dw + l < du. A search stops as soon as its queue minimum is at least the
+ * best distance found.
+ * Copying a context is cheap compared to the index, which is shared.
+ */
+class ch_query {
+
+public:
+    using rank_t = ch_index::rank_t;
+    static constexpr auto dist_infinity = dist_max;
+
+protected:
+
+    std::shared_ptr<const ch_index> idx;
+
+    struct upward_search : public traversal<static_digraph> {
+        void start(std::size_t n, node src) ;
+        // Distance of the next node to settle (infinity if none).
+        dist min_dist() ;
+        // Settle next node and return it with its distance. Its edges in
+        // [up] are scanned unless it can be stalled through edges in
+        // [down], [stalled] is then set to true. Edges of nodes with
+        // internal id less than [core_end] are not scanned.
+        node_dist settle_next(const static_digraph & up,
+                              const static_digraph & down, bool & stalled,
+                              std::size_t core_end = 0) ;
+        std::size_t nb_settled() const { return visited_nodes.size(); }
+        // Node from which [u] was last reached ([src] for itself).
+        node parent(node u) const { return parents[u]; }
+
+        // Complete upward search from [src], calling [f(ud)] for each
+        // node settled (and not stalled) with its distance (up to
+        // distance [limit]).
+        template <typename F>
+        void search_all(std::size_t n, node src, const static_digraph & up,
+                        const static_digraph & down, F f,
+                        dist limit = dist_infinity) {
+            start(n, src);
+            bool stalled;
+            while (min_dist() <= limit && min_dist() < dist_infinity) {
+                node_dist ud = settle_next(up, down, stalled);
+                if ( ! stalled) { f(ud); }
+            }
+        }
+        // Same as search_all() but the search stops as soon as the next
+        // node is at distance [bound()] or more, [bound()] may decrease
+        // during the search.
+        template <typename F, typename B>
+        void search_bounded(std::size_t n, node src,
+                            const static_digraph & up,
+                            const static_digraph & down, F f, B bound) {
+            start(n, src);
+            bool stalled;
+            while (min_dist() < bound()) {
+                node_dist ud = settle_next(up, down, stalled);
+                if ( ! stalled) { f(ud); }
+            }
+        }
+    protected:
+        std::vector<node> parents;
+    };
+    upward_search fwd_search, bwd_search;
+    node meeting; // where searches of the last distance() query met
+
+    // Table of the core for distance() (none by default), and core nodes
+    // settled by each search of the current query:
+    std::shared_ptr<const core_table> core;
+    std::vector<node_dist> core_fwd, core_bwd;
+
+    dist hierarchy_distance(node src, node dst) ;
+    dist core_distance(node src, node dst) ;
+
+public:
+
+    ch_query() : idx(std::make_shared<ch_index>()) {}
+
+    // Context for querying [index].
+    explicit ch_query(std::shared_ptr<const ch_index> index) ;
+
+    // Context for a new index (see ch_index constructors).
+    ch_query(const digraph & fwd, const digraph & bwd,
+             const std::vector<std::size_t> & rank) ;
+    ch_query(frozen_array<rank_t> rank,
+             static_digraph up_fwd, static_digraph up_bwd,
+             frozen_array<node> to_internal = {},
+             frozen_array<node> to_external = {}) ;
+
+    const std::shared_ptr<const ch_index> & index() const { return idx; }
+
+    const frozen_array<rank_t> & ranks() const { return idx->ranks(); }
+    const static_digraph & upward_fwd() const { return idx->upward_fwd(); }
+    const static_digraph & upward_bwd() const { return idx->upward_bwd(); }
+    std::size_t nb_nodes() const { return idx->nb_nodes(); }
+    std::size_t nb_edges() const { return idx->nb_edges(); }
+
+    dist distance(node src, node dst) ;
+
+    // Use [table] (a core_table of the same index) in distance() queries:
+    // searches stop at core nodes, which are joined through the table. A
+    // null [table] restores plain searches.
+    void set_core_table(std::shared_ptr<const core_table> table) ;
+    const std::shared_ptr<const core_table> & core_distances() const {
+        return core;
+    }
+
+    // Returns the nodes of a shortest path from [src] to [dst] in the
+    // hierarchy: consecutive nodes are linked by hierarchy edges, which may
+    // be shortcuts (see contraction::path() for unpacking them). The path
+    // is empty if [dst] cannot be reached from [src].
+    std::vector<node> hierarchy_path(node src, node dst) ;
+
+    // Returns the distances from [sources] to [targets] as a matrix stored
+    // row by row: distance from sources[i] to targets[j] is at index
+    // i * targets.size() + j. It uses buckets: the backward upward search
+    // space of each target is stored in buckets at its nodes, which are
+    // scanned by the forward upward search from each source. This requires
+    // |sources| + |targets| searches instead of |sources| * |targets|.
+    std::vector<dist> distance_table(const std::vector<node> & sources,
+                                     const std::vector<node> & targets) ;
+
+    // Complete forward upward search from [src], calling [f(ud)] with each
+    // node settled (and not stalled) and its distance from [src]. Nodes
+    // further than [limit] are not searched.
+    template <typename F>
+    void forward_search_space(node src, F f, dist limit = dist_infinity) {
+        const ch_index & ix = *idx;
+        fwd_search.search_all(nb_nodes(), ix.internal(src), ix.upward_fwd(),
+                              ix.upward_bwd(), [&ix, &f](node_dist ud) {
+                                  f(node_dist(ix.external(ud._node), ud._dist));
+                              }, limit);
+    }
+
+    // Forward upward search from [src] as above, stopped as soon as the
+    // next node to settle is at distance [bound()] or more from [src]
+    // ([bound()] may decrease as nodes are reported to [f]).
+    template <typename F, typename B>
+    void forward_search_space_bounded(node src, F f, B bound) {
+        const ch_index & ix = *idx;
+        fwd_search.search_bounded(nb_nodes(), ix.internal(src), ix.upward_fwd(),
+                                  ix.upward_bwd(), [&ix, &f](node_dist ud) {
+                                      f(node_dist(ix.external(ud._node),
+                                                  ud._dist));
+                                  }, bound);
+    }
+
+    // Complete backward upward search from [dst], calling [f(ud)] with each
+    // node settled (and not stalled) and its distance to [dst].
+    template <typename F>
+    void backward_search_space(node dst, F f) {
+        const ch_index & ix = *idx;
+        bwd_search.search_all(nb_nodes(), ix.internal(dst), ix.upward_bwd(),
+                              ix.upward_fwd(), [&ix, &f](node_dist ud) {
+                                  f(node_dist(ix.external(ud._node), ud._dist));
+                              });
+    }
+
+    // Counters of both searches since construction or last clear_stats()
+    // (only incremented with CH_STATS defined, see stats.hh).
+    traversal_stats stats() const {
+        traversal_stats s = fwd_search.stats();
+        s += bwd_search.stats();
+        return s;
+    }
+    void clear_stats() { fwd_search.clear_stats(); bwd_search.clear_stats(); }
+
+    // Number of nodes settled by the last query (in both directions).
+    std::size_t nb_settled() const {
+        return fwd_search.nb_settled() + bwd_search.nb_settled();
+    }
+};
+
+/** Queries spread over a pool of threads, each with its own context on a
+ * shared index. Threads are started by each call, contexts are kept from
+ * one call to the next.
+ */
+class ch_query_pool {
+
+protected:
+    std::shared_ptr<const ch_index> idx;
+    std::vector<ch_query> contexts; // one per thread
+
+public:
+
+    // Pool of [nb_threads] threads (0 means one per hardware thread).
+    explicit ch_query_pool(std::shared_ptr<const ch_index> index,
+                           std::size_t nb_threads = 0) ;
+
+    std::size_t nb_threads() const { return contexts.size(); }
+
+    // Call [f(i, q)] for i = 0..count-1 where [q] is the context of the
+    // thread handling [i].
+    template <typename F>
+    void parallel_for(std::size_t count, F f) {
+        ch::parallel_for(count, contexts.size(),
+                         [this, &f](std::size_t i, std::size_t t) {
+                             f(i, contexts[t]);
+                         });
+    }
+
+    // Returns the distance for each (source, target) pair of [queries].
+    std::vector<dist> distances(const std::vector<std::pair<node, node>>
+                                & queries) ;
+};
+
+namespace unit {
+    void test_ch_query();
+}
+
+}
@@ -3,36 +3,91 @@
 #include <iomanip>
 #include <ctime>
 #include <chrono>
+#include <limits>
+#include <random>
+#include <sys/resource.h>
 
 #include "contraction.hh"
+#include "parallel.hh"
+#include "core_table.hh"
 #include "label_edges.hh"
 
 namespace ch {
 
-contraction::contraction(const digraph &g, const std::vector<node> &keep)
-    : fwd(g.no_loop()), bwd(fwd.reverse()),
-      contractible(), in_contracted_gr(g.nb_nodes(), true),
-      contract_rank(g.nb_nodes(), g.nb_nodes()), current_rank(0),
-      in_degrees(g.nb_nodes()), out_degrees(g.nb_nodes())
+contraction::contraction(const digraph &g, const std::vector<node> &keep,
+                         std::size_t nb_threads)
+    : contraction(digraph(g), keep, nb_threads) {}
+
+contraction::contraction(digraph &&g, const std::vector<node> &keep,
+                         std::size_t nb_threads)
+    : fwd(std::move(g)), query_outdated(false), core_mode(false),
+      workspaces(nb_threads > 0 ? nb_threads
+                 : std::max(1u, std::thread::hardware_concurrency())),
+      witness_max_settled(std::numeric_limits<std::size_t>::max()),
+      witness_max_hops(std::numeric_limits<unsigned>::max()),
+      contractible(fwd.nb_nodes(), true), nb_contractible(fwd.nb_nodes()),
+      in_contracted_gr(fwd.nb_nodes(), true),
+      contract_rank(fwd.nb_nodes(), fwd.nb_nodes()), current_rank(0),
+      in_degrees(fwd.nb_nodes()), out_degrees(fwd.nb_nodes()),
+      order(ordering::rounds)
 {
+    fwd.remove_loops();
+    fwd.merge_parallel_edges(); // keep the shortest
+    bwd = fwd.reverse();
 
     // statistices on subgraph induced by [in_contracted_gr]
     n = fwd.nb_nodes();
     m = fwd.nb_edges();
     for (node u : fwd) { out_degrees[u] = fwd.out_degree(u); }
     for (node u : bwd) { in_degrees[u] = bwd.out_degree(u); }
-        
+
+    up_len_below.push_back(0); // no node has rank < 0
+
     // Contractible is the complement of keep:
-    for (node u : g) contractible.insert(u);
-    for (node u : keep) contractible.erase(u);
+    for (node u : keep) {
+        if (contractible[u]) { contractible[u] = false; --nb_contractible; }
+    }
+}
+
+void contraction::set_ordering(ordering o) {
+    order = o;
+    if (o == ordering::lazy_priority && priority.empty()) {
+        priority.assign(fwd.nb_nodes(), 0);
+        contracted_neighbors.assign(fwd.nb_nodes(), 0);
+        depth.assign(fwd.nb_nodes(), 0);
+    }
+}
+
+void contraction::set_witness_limits(std::size_t max_settled,
+                                     unsigned max_hops) {
+    witness_max_settled = max_settled;
+    witness_max_hops = max_hops;
 }
     
+// Print the peak resident memory of the process so far.
+static void report_peak_memory() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) { // ru_maxrss in KB on Linux
+        std::cerr <<"peak memory: "<< usage.ru_maxrss / 1024 <<"MB\n";
+    }
+    std::cerr << std::flush;
+}
+
 digraph & contraction::contract(float max_avg_deg) {
     std::size_t round = 0, last_round = 0;
     auto start = std::chrono::high_resolution_clock::now();
     while (true) {
-        if (m >= max_avg_deg * n || contractible.empty()) break;
-        std::size_t ncontracted = contract_round();
+        if (m >= max_avg_deg * n || nb_contractible == 0) break;
+#ifdef CH_STATS
+        auto round_start = std::chrono::high_resolution_clock::now();
+#endif
+        std::size_t ncontracted = order == ordering::rounds ? contract_round()
+            : contract_lazy(std::max(std::size_t(1), nb_contractible / 16),
+                            max_avg_deg);
+        CH_STAT(collect_round_stats(ncontracted, std::chrono::duration
+                                    <double, std::milli>
+                                    (std::chrono::high_resolution_clock::now()
+                                     - round_start).count()));
         ++round;
         if (round >= 3 * last_round / 2) {
             last_round = round;
@@ -56,7 +111,13 @@ digraph & contraction::contract(float max_avg_deg) {
               <<" avg_out_deg="<< (n == 0 ? 0 : float(m)/n)
               <<" in "<< duration.count() / 1000. <<"s\n"
               <<"contraction hierarchies (CH) n="<< fwd.nb_nodes()
-              <<" m="<< fwd.nb_edges() <<"\n" << std::flush;
+              <<" m="<< fwd.nb_edges() <<"\n";
+    counters.graph_bytes = fwd.memory_bytes() + bwd.memory_bytes();
+    changed_edges.clear(); // the index is rebuilt on first use
+    query_outdated = true;
+    report_peak_memory();
+    unpacked.clear();
+    unpacked_nodes.clear();
     //for (auto i : contract_rank) { std::cerr <<" "<< i; } std::cerr<<"\n";
     return fwd;
 }
@@ -67,13 +128,59 @@ const std::vector<node> & contraction::contraction_order () const {
     return contract_order;
 }
 
+const std::vector<std::size_t> & contraction::contraction_ranks () const {
+    return contract_rank;
+}
+
+void contraction::build_query() {
+    if (query_outdated || changed_edges.empty()) {
+        query = ch_query(fwd, bwd, contract_rank);
+    } else { // same edges: patch their lengths in a copy of the index
+        query = ch_query(std::make_shared<ch_index>(*query.index(),
+                                                    changed_edges));
+    }
+    changed_edges.clear();
+    const std::size_t core_size = query.index()->core_size();
+    if (core_mode && core_size > 0
+        && core_size <= core_table::max_core_size) {
+        query.set_core_table(std::make_shared<core_table>(
+                                 *query.index(), workspaces.size()));
+    }
+    query_outdated = false;
+}
+
+void contraction::refresh_query() {
+    if (query.nb_nodes() != fwd.nb_nodes()) { // not built yet
+        changed_edges.clear();
+        query_outdated = true;
+    }
+    if (query_outdated || ! changed_edges.empty()) { build_query(); }
+}
+
+void contraction::set_core_table(bool use) {
+    core_mode = use;
+    query_outdated = true;
+}
+
 dist contraction::distance(node src, node dst) {
-    return trav_fwd.bidir_dijkstra
-        (fwd, bwd, trav_bwd,
-         src, dst, trav_fwd.dist_infinity, true,
-         [this](node v, dist d, node par) {
-            return contract_rank[par] < contract_rank[v];
-        });
+    refresh_query();
+    return query.distance(src, dst);
+}
+
+std::vector<dist> contraction::distance_table(const std::vector<node> & sources,
+                                              const std::vector<node> & targets) {
+    refresh_query();
+    return query.distance_table(sources, targets);
+}
+
+ch_query & contraction::query_engine() {
+    refresh_query();
+    return query;
+}
+
+std::shared_ptr<const ch_index> contraction::query_index() {
+    refresh_query();
+    return query.index();
 }
 
 
@@ -99,85 +206,529 @@ std::size_t contraction::fill_degree(node u) {
 }
 
 
+template <typename F>
+void contraction::parallel_for(std::size_t count, F f) {
+    ch::parallel_for(count, workspaces.size(),
+                     [this, &f](std::size_t i, std::size_t t) {
+                         f(i, workspaces[t]);
+                     });
+}
+
 // Returns number of nodes contracted.
 std::size_t contraction::contract_round() {
     std::vector<vtx_deg> vtx;
-    for (node u : contractible) { vtx.push_back({ u, fill_degree(u) }); }
+    for (node u : fwd) {
+        if (contractible[u]) { vtx.push_back({ u, fill_degree(u) }); }
+    }
     std::sort(vtx.begin(), vtx.end(), cmp_vtx_deg);
 
     std::vector<node> contr;
     const float min_pct = 1.0; // set stoping threshold at this percentage
     std::size_t fill_deg_thr = 0, i = 0, n = vtx.size();
-    std::set<node> neighb_of_contr;
+    std::vector<bool> neighb_of_contr(fwd.nb_nodes(), false);
 
     for (auto ud : vtx) {
         if (i * 100 < min_pct * n) { fill_deg_thr = ud.deg; }
         else { if (4 * ud.deg > 5 * fill_deg_thr) { break; } }
         node u = ud.vtx;
-        if ( neighb_of_contr.find(u) == neighb_of_contr.end()) {
+        if ( ! neighb_of_contr[u]) {
             ++i;
             for (auto e : bwd.out_neighbors(u)) {
-                neighb_of_contr.insert(e.dst);
+                neighb_of_contr[e.dst] = true;
             } 
             for (auto e : fwd.out_neighbors(u)) {
-                neighb_of_contr.insert(e.dst);
+                neighb_of_contr[e.dst] = true;
             }
             contr.push_back(u);
         }
     }
-    for (node u : contr) { contract_node(u); }
+
+    // Witness searches in parallel, shortcuts are merged in [contr] order
+    // so that the result does not depend on thread scheduling.
+    for (node u : contr) { in_contracted_gr[u] = false; }
+    struct slice { const workspace *ws; std::size_t beg, end; };
+    std::vector<slice> slices(contr.size());
+    for (auto & ws : workspaces) { ws.shortcuts.clear(); }
+    parallel_for(contr.size(), [this, &contr, &slices](std::size_t i,
+                                                       workspace & ws) {
+            std::size_t beg = ws.shortcuts.size();
+            contraction_shortcuts(contr[i], ws);
+            slices[i] = { &ws, beg, ws.shortcuts.size() };
+        });
+
+    for (std::size_t i = 0; i < contr.size(); ++i) {
+        const slice & s = slices[i];
+        contract_node(contr[i], erange(s.ws->shortcuts.cbegin() + s.beg,
+                                       s.ws->shortcuts.cbegin() + s.end));
+    }
     return contr.size();
 }
 
-void contraction::contract_node(node u) {
-    in_contracted_gr[u] = false;
+// Witness searches of priority estimates (for neighbors of contracted nodes)
+// only look for very short witnesses:
+constexpr std::size_t estimate_max_settled = 5;
+
+std::int64_t contraction::simulated_priority(node u, workspace & ws,
+                                             std::size_t max_settled) const {
+    ws.shortcuts.clear();
+    contraction_shortcuts(u, ws, max_settled);
+    std::int64_t added = 0;
+    for (const edge & s : ws.shortcuts) {
+        bool present = false;
+        for (auto e : fwd.out_neighbors(s.src)) {
+            if (e.dst == s.dst) { present = true; break; }
+        }
+        if ( ! present) { ++added; }
+    }
+    const std::int64_t removed = std::int64_t(in_degrees[u])
+                                 + std::int64_t(out_degrees[u]);
+    return 2 * (4 * added - removed) + contracted_neighbors[u] + depth[u];
+}
+
+std::size_t contraction::contract_lazy(std::size_t count, float max_avg_deg) {
+    if (prio_queue.empty()) { // initial priorities
+        std::vector<node> nodes;
+        nodes.reserve(nb_contractible);
+        for (node u : fwd) { if (contractible[u]) nodes.push_back(u); }
+        parallel_for(nodes.size(), [this, &nodes](std::size_t i,
+                                                  workspace & ws) {
+                priority[nodes[i]] = simulated_priority(nodes[i], ws,
+                                                        estimate_max_settled);
+            });
+        for (node u : nodes) { prio_queue.push({ priority[u], u }); }
+    }
+    workspace & ws = workspaces[0];
+    std::vector<node> neighbs;
+    std::size_t ncontracted = 0;
+    while (ncontracted < count && ! prio_queue.empty()
+           && m < max_avg_deg * n) {
+        const node u = prio_queue.top().second;
+        const std::int64_t prio = prio_queue.top().first;
+        prio_queue.pop();
+        if ( ! in_contracted_gr[u] || prio != priority[u]) continue; // stale
+        // Exact priority, and the shortcuts to add:
+        priority[u] = simulated_priority
+            (u, ws, std::numeric_limits<std::size_t>::max());
+        while ( ! prio_queue.empty()) { // compare with a valid entry
+            const prio_node & t = prio_queue.top();
+            if (in_contracted_gr[t.second] && t.first == priority[t.second]
+                && t.second != u) break;
+            prio_queue.pop(); // stale
+        }
+        if ( ! prio_queue.empty() && priority[u] > prio_queue.top().first) {
+            prio_queue.push({ priority[u], u }); // lazy update
+            continue;
+        }
+
+        neighbs.clear();
+        for (auto e : bwd.out_neighbors(u)) {
+            if (in_contracted_gr[e.dst]) { neighbs.push_back(e.dst); }
+        }
+        for (auto e : fwd.out_neighbors(u)) {
+            if (in_contracted_gr[e.dst]) { neighbs.push_back(e.dst); }
+        }
+        std::sort(neighbs.begin(), neighbs.end());
+        neighbs.erase(std::unique(neighbs.begin(), neighbs.end()),
+                      neighbs.end());
+
+        in_contracted_gr[u] = false;
+        contract_node(u, erange(ws.shortcuts.cbegin(), ws.shortcuts.cend()));
+        ++ncontracted;
+
+        // Update neighbors (their edge difference may have decreased,
+        // which the check above would miss):
+        for (node v : neighbs) {
+            ++(contracted_neighbors[v]);
+            depth[v] = std::max(depth[v], depth[u] + 1);
+            if (contractible[v]) {
+                priority[v] = simulated_priority(v, ws, estimate_max_settled);
+                prio_queue.push({ priority[v], v });
+            }
+        }
+    }
+    return ncontracted;
+}
+
+void contraction::contraction_shortcuts(node u, workspace & ws,
+                                        std::size_t max_settled) const {
+    std::vector<node> & targets = ws.targets;
+    targets.clear();
+    dist max_f_len = 0;
+    for (auto f : fwd.out_neighbors(u)) {
+        if ( ! in_contracted_gr[f.dst]) continue;
+        targets.push_back(f.dst);
+        if (max_f_len < f.len) { max_f_len = f.len; }
+    }
+    // Targets are distinct (fwd has no parallel edges), a linear scan is
+    // faster for a few of them:
+    const bool sorted = targets.size() > 16;
+    if (sorted) { std::sort(targets.begin(), targets.end()); }
+    auto is_target = [&targets, sorted](node x) {
+        return sorted ? std::binary_search(targets.begin(), targets.end(), x)
+            : std::find(targets.begin(), targets.end(), x) != targets.end();
+    };
+    for (auto e : bwd.out_neighbors(u)) {
+        if ( ! in_contracted_gr[e.dst]) continue;
+        const node src = e.dst; // not a target
+        std::size_t nb_targets = targets.size() - is_target(src);
+        if (nb_targets == 0) continue;
+        // one-to-many witness search:
+        CH_STAT(++ws.witness_searches);
+        ws.trav.limited_dijkstra
+            (fwd, src, e.len + max_f_len,
+             std::min(witness_max_settled, max_settled), witness_max_hops,
+             [&is_target, &nb_targets, src](node x) {
+                return x != src && is_target(x) && --nb_targets == 0;
+            },
+             [this, u](node x, dist d) {
+                return x != u && in_contracted_gr[x];
+            });
+        for (auto f : fwd.out_neighbors(u)) {
+            if ( ! in_contracted_gr[f.dst] || f.dst == e.dst) continue;
+            const dist d_ef = e.len + f.len;
+            if (d_ef < ws.trav.distance(f.dst)) {
+                ws.shortcuts.emplace_back(e.dst, f.dst, d_ef);
+            } else { CH_STAT(++ws.witness_hits); }
+        }
+    }
+}
+
+void contraction::collect_round_stats(std::size_t ncontracted, double ms) {
+    cur_round.contracted = ncontracted;
+    cur_round.ms = ms;
+    for (workspace & ws : workspaces) {
+        cur_round.witness_searches += ws.witness_searches;
+        cur_round.witness_hits += ws.witness_hits;
+        ws.witness_searches = 0;
+        ws.witness_hits = 0;
+        counters.witness += ws.trav.stats();
+        ws.trav.clear_stats();
+    }
+    counters.rounds.push_back(cur_round);
+    cur_round = round_stats();
+}
+
+void contraction::contract_node(node u, erange shortcuts) {
+    assert( ! in_contracted_gr[u]);
     contract_rank[u] = current_rank++;
     contract_order.push_back(u);
-    contractible.erase(u);
+    if (contractible[u]) { contractible[u] = false; --nb_contractible; }
     --n;
     m -= in_degrees[u];
     m -= out_degrees[u];
-    bool first_iter = true;
+    dist up_len = up_len_below.back(); // max with upward edges of u
     for (auto e : bwd.out_neighbors(u)) {
-        if (in_contracted_gr[e.dst]) {
-            --(out_degrees[e.dst]); // u lost
-            for (auto f : fwd.out_neighbors(u)) {
-                if (in_contracted_gr[f.dst]) {
-                    if (first_iter) { --(in_degrees[f.dst]); } // u lost
-                    const dist d_ef = e.len + f.len;
-                    if (e.dst != f.dst
-                        && d_ef < trav_fwd.bidir_dijkstra
-                        (fwd, bwd, trav_bwd,
-                         e.dst, f.dst, d_ef, false,
-                         [this](node x, dist d, node _) {
-                            return in_contracted_gr[x];
-                        })
-                        ) {
-                        const bool fadd = fwd.update_edge(e.dst, f.dst, d_ef);
-                        const bool badd = bwd.update_edge(f.dst, e.dst, d_ef);
-                        assert(fadd == badd);
-                        if (fadd || badd) {
-                            ++m;
-                            ++(out_degrees[e.dst]);
-                            ++(in_degrees[f.dst]);
-                        }
-                    }
-                }
-            }
-            first_iter = false;
+        if (in_contracted_gr[e.dst]) { // u lost
+            --(out_degrees[e.dst]);
+            up_len = std::max(up_len, dist(e.len));
         }
     }
-    if (first_iter) {
-        for (auto f : fwd.out_neighbors(u)) {
-            if (in_contracted_gr[f.dst]) {
-                if (first_iter) { --(in_degrees[f.dst]); } // u lost
+    for (auto f : fwd.out_neighbors(u)) {
+        if (in_contracted_gr[f.dst]) { // u lost
+            --(in_degrees[f.dst]);
+            up_len = std::max(up_len, dist(f.len));
+        }
+    }
+    up_len_below.push_back(up_len);
+    for (const edge & s : shortcuts) {
+        const std::size_t p = edge_pos(s.src, s.dst);
+        bool shorter = true;
+        if (p < fwd.out_degree(s.src)) {
+            const edge_len l = fwd.out_neighbors(s.src).begin()[p].len;
+            shorter = s.len < l;
+            if (shorter && ! middles.find(s.src, s.dst)) { // original edge
+                replaced_len.set(s.src, s.dst, l);
             }
         }
+        const bool fadd = fwd.update_edge(s.src, s.dst, s.len);
+        const bool badd = bwd.update_edge(s.dst, s.src, s.len);
+        assert(fadd == badd);
+        if (shorter) { middles.set(s.src, s.dst, u); } // added or shortened
+        CH_STAT(if (fadd) ++cur_round.shortcuts_added;
+                else if (shorter) ++cur_round.shortcuts_updated);
+        if (fadd || badd) {
+            ++m;
+            ++(out_degrees[s.src]);
+            ++(in_degrees[s.dst]);
+        }
     }
 }
 
 
 
+std::size_t contraction::edge_pos(node u, node v) const {
+    std::size_t p = 0;
+    for (auto e : fwd.out_neighbors(u)) {
+        if (e.dst == v) break;
+        ++p;
+    }
+    return p;
+}
+
+node contraction::shortcut_middle(node u, node v) const {
+    const node *mid = middles.find(u, v);
+    return mid != nullptr ? *mid : node();
+}
+
+void contraction::unpack_edge(node u, node v, std::vector<node> & p,
+                              bool with_v) const {
+    const std::uint64_t key = shortcut_key(u, v);
+    if ( ! unpacked.empty()) {
+        auto it = unpacked.find(key);
+        if (it != unpacked.end()) {
+            p.insert(p.end(), unpacked_nodes.begin() + it->second.first,
+                     unpacked_nodes.begin() + it->second.second);
+            if (with_v) { p.push_back(v); }
+            return;
+        }
+    }
+    const node mid = shortcut_middle(u, v);
+    if (mid.valid()) {
+        unpack_edge(u, mid, p, true);
+        unpack_edge(mid, v, p, false);
+    }
+    if (with_v) { p.push_back(v); }
+}
+
+std::vector<node> contraction::path(node src, node dst) {
+    refresh_query();
+    std::vector<node> hp = query.hierarchy_path(src, dst), p;
+    if (hp.empty()) return p;
+    p.push_back(src);
+    for (std::size_t i = 0; i + 1 < hp.size(); ++i) {
+        unpack_edge(hp[i], hp[i+1], p);
+    }
+    return p;
+}
+
+void contraction::cache_unpacked_shortcuts(std::size_t min_rank) {
+    unpacked.clear();
+    unpacked_nodes.clear();
+    // Lower shortcuts first so that higher ones reuse their unpacking:
+    std::vector<std::pair<std::size_t, std::uint64_t>> todo; // rank, key
+    middles.for_each([this, min_rank, &todo](node u, node v, node) {
+            if (contract_rank[u] >= min_rank && contract_rank[v] >= min_rank) {
+                todo.emplace_back(std::min(contract_rank[u], contract_rank[v]),
+                                  shortcut_key(u, v));
+            }
+        });
+    std::sort(todo.begin(), todo.end());
+    std::vector<node> p;
+    for (const auto & rk : todo) {
+        node u(rk.second >> 32), v(rk.second & 0xffffffffu);
+        p.clear();
+        unpack_edge(u, v, p, false);
+        const std::size_t beg = unpacked_nodes.size();
+        unpacked_nodes.insert(unpacked_nodes.end(), p.begin(), p.end());
+        unpacked[rk.second] = { beg, unpacked_nodes.size() };
+    }
+}
+
+// Length of edge [u]->[v] in [g] (infinity if absent).
+static dist edge_length(const digraph & g, node u, node v) {
+    dist l = dist_max;
+    for (auto e : g.out_neighbors(u)) {
+        if (e.dst == v && e.len < l) { l = e.len; }
+    }
+    return l;
+}
+
+void contraction::raise_up_len(std::size_t r, dist l) {
+    // up_len_below[] is non-decreasing: stop at the first value >= l.
+    for (std::size_t i = r + 1; i < up_len_below.size(); ++i) {
+        if (up_len_below[i] >= l) break;
+        up_len_below[i] = l;
+    }
+}
+
+dist contraction::original_length(node u, node v) const {
+    const edge_len *l = replaced_len.find(u, v);
+    if (l != nullptr) return *l;
+    if (middles.find(u, v) != nullptr) return dist_max; // a shortcut
+    const std::size_t p = edge_pos(u, v);
+    if (p == fwd.out_degree(u)) return dist_max;
+    return fwd.out_neighbors(u).begin()[p].len; // not replaced
+}
+
+bool contraction::update_edge_length(node u, node v, edge_len len) {
+    if (u == v) return false; // loops are removed
+    const dist old_len = original_length(u, v);
+    if (old_len == dist_max) return false; // not an edge of the graph
+    if (len == old_len) return true;
+    const std::size_t top = fwd.nb_nodes(); // rank of uncontracted nodes
+    const std::vector<std::size_t> & rank = contract_rank;
+    workspace & ws = workspaces[0];
+
+    // For an increase, a witness for pair x, y around z can only become
+    // too long if one of its edges (all above z) got longer, and such an
+    // edge a->b is u->v or a shortcut that goes through u->v once
+    // unpacked. The witness then has length at least d(x,u) + old_len +
+    // d(v,y) and at most the length of x->z->y, which is at most twice the
+    // longest upward edge of a node of rank less than min(rank a, rank b)
+    // (see up_len_below). Edges that got longer are known once lengths
+    // are recomputed, balls around u and v are then computed with their
+    // former lengths (the hierarchy had the distances of the graph
+    // before the update):
+    const bool increase = old_len < len;
+    std::vector<edge> increased; // with their former lengths
+    replaced_len.set(u, v, len); // until u->v is recomputed
+    unpacked.clear();
+    unpacked_nodes.clear();
+
+    // Edges to recompute, by increasing minimum rank of their extremities
+    // (their length only depends on edges with lower minimum rank):
+    using rank_edge = std::pair<std::size_t, std::uint64_t>; // rank, key
+    std::priority_queue<rank_edge, std::vector<rank_edge>,
+                        std::greater<rank_edge>> to_update;
+    std::unordered_map<std::uint64_t, bool> queued;
+    auto push_update = [&](node a, node b) {
+        const std::uint64_t key = shortcut_key(a, b);
+        if (queued.emplace(key, true).second) {
+            to_update.push({ std::min(rank[a], rank[b]), key });
+        }
+    };
+    // Pairs x, y around z to check for a witness:
+    struct triangle { node x, z, y; };
+    std::vector<triangle> checks;
+    // Edges whose length depend on a->b (x->z->y with a->b as x->z or
+    // z->y, z being the lower of a and b), and if [decreased], pairs
+    // without an edge to check:
+    auto push_dependents = [&](node a, node b, bool decreased) {
+        if (rank[b] < rank[a]) {
+            for (auto f : fwd.out_neighbors(b)) {
+                node c = f.dst;
+                if (c == a || rank[c] <= rank[b]) continue;
+                if (edge_length(fwd, a, c) < dist_max) { push_update(a, c); }
+                else if (decreased) { checks.push_back({ a, b, c }); }
+            }
+        } else if (rank[a] < rank[b]) {
+            for (auto e : bwd.out_neighbors(a)) {
+                node c = e.dst;
+                if (c == b || rank[c] <= rank[a]) continue;
+                if (edge_length(fwd, c, b) < dist_max) { push_update(c, b); }
+                else if (decreased) { checks.push_back({ c, a, b }); }
+            }
+        }
+    };
+    // Upward searches (nodes above x and y are above z):
+    auto upward = [&rank, top](node w, dist d, node par) {
+        return rank[w] > rank[par] || rank[w] == top;
+    };
+
+    push_update(u, v);
+    bool balls_scanned = ! increase;
+    while (true) {
+        // Recompute lengths from original lengths and middle nodes:
+        while ( ! to_update.empty()) {
+            const std::uint64_t key = to_update.top().second;
+            to_update.pop();
+            queued.erase(key);
+            node a(key >> 32), b(key & 0xffffffffu);
+            const dist cur = edge_length(fwd, a, b);
+            const dist o = original_length(a, b);
+            dist best = o;
+            node mid;
+            const std::size_t r = std::min(rank[a], rank[b]);
+            for (auto e : fwd.out_neighbors(a)) {
+                if (rank[e.dst] >= r) continue;
+                const dist l_zb = edge_length(fwd, e.dst, b);
+                if (l_zb < dist_max && e.len + l_zb < best) {
+                    best = e.len + l_zb;
+                    mid = e.dst;
+                }
+            }
+            assert(best < dist_max);
+            if (mid.valid()) {
+                middles.set(a, b, mid);
+                if (o < dist_max) { replaced_len.set(a, b, o); }
+            } else { // best == o
+                middles.erase(a, b);
+                replaced_len.erase(a, b);
+            }
+            if (best == cur) continue;
+            fwd.set_edge_length(a, b, best);
+            bwd.set_edge_length(b, a, best);
+            changed_edges.emplace_back(a, b, best);
+            if (increase && cur < best) { increased.emplace_back(a, b, cur); }
+            raise_up_len(r, best);
+            push_dependents(a, b, best < cur);
+        }
+        // Pairs whose witness could use an increased edge (around z of
+        // lower rank than both its extremities), once lengths are
+        // recomputed (only decreases follow):
+        if ( ! balls_scanned) {
+            balls_scanned = true;
+            std::size_t r_max = 0; // z has rank less than r_max
+            for (const edge & e : increased) {
+                r_max = std::max(r_max, std::min(rank[e.src], rank[e.dst]));
+            }
+            const std::uint64_t max_len = 2 * std::uint64_t
+                (up_len_below[std::min(r_max, up_len_below.size() - 1)]);
+            if (max_len <= std::uint64_t(old_len)) continue;
+            const dist radius(std::min(max_len - old_len,
+                                       std::uint64_t(dist_max - 1u)));
+            auto within = [radius](node x, dist d) { return d <= radius; };
+            auto swap_lengths = [this, &increased]() {
+                for (edge & e : increased) {
+                    const edge_len l = edge_length(fwd, e.src, e.dst);
+                    fwd.set_edge_length(e.src, e.dst, e.len);
+                    bwd.set_edge_length(e.dst, e.src, e.len);
+                    e.len = l;
+                }
+            };
+            swap_lengths(); // former lengths
+            ws.trav.dijkstra(bwd, u, within); // d(x,u)
+            ws.bwd_trav.dijkstra(fwd, v, within); // d(v,y)
+            swap_lengths(); // back to new lengths
+            for (node x : ws.trav.settled_nodes()) {
+                const std::uint64_t d_xu = ws.trav.distance(x);
+                for (auto e : fwd.out_neighbors(x)) {
+                    node z = e.dst;
+                    if (rank[z] >= rank[x] || rank[z] >= r_max) continue;
+                    for (auto f : fwd.out_neighbors(z)) {
+                        node y = f.dst;
+                        if (y == x || rank[y] <= rank[z]) continue;
+                        const dist d_vy = ws.bwd_trav.distance(y);
+                        if (d_vy < dist_max
+                            && d_xu + old_len + d_vy
+                               <= std::uint64_t(e.len) + f.len) {
+                            checks.push_back({ x, z, y });
+                        }
+                    }
+                }
+            }
+        }
+        if ( ! to_update.empty()) continue;
+        if (checks.empty()) break;
+        const triangle t = checks.back();
+        checks.pop_back();
+        // An edge x->y may be longer than x->z->y when a witness was found
+        // at contraction: recomputing it makes it at most x->z->y.
+        if (edge_length(fwd, t.x, t.y) < dist_max) {
+            push_update(t.x, t.y);
+            continue;
+        }
+        const dist l = edge_length(fwd, t.x, t.z) + edge_length(fwd, t.z, t.y);
+        const dist witness = ws.trav.bidir_dijkstra(fwd, bwd, ws.bwd_trav,
+                                                    t.x, t.y, l + 1, true,
+                                                    upward);
+        if (witness <= l) continue;
+        // New shortcut:
+        fwd.add_edge(t.x, t.y, l);
+        bwd.add_edge(t.y, t.x, l);
+        middles.set(t.x, t.y, t.z);
+        raise_up_len(std::min(rank[t.x], rank[t.y]), l);
+        query_outdated = true; // new index edge
+        if (in_contracted_gr[t.x] && in_contracted_gr[t.y]) {
+            ++m;
+            ++(out_degrees[t.x]);
+            ++(in_degrees[t.y]);
+        }
+        push_dependents(t.x, t.y, true);
+    }
+    return true;
+}
+
 
 namespace unit {
 
@@ -210,6 +761,11 @@ namespace unit {
             }
         }
 
+        // Queries before any contraction:
+        contraction fresh(g);
+        trav.dijkstra(g, node(0));
+        for (node v : g) { CHECK(fresh.distance(node(0), v) == trav.distance(v)); }
+
         // Finish contraction:
         g_ch = contr.contract();
         std::cout <<"contraction : n="<< g_ch.n() <<" m="<< g_ch.m() <<"\n";
@@ -238,9 +794,160 @@ namespace unit {
             //std::cout <<"\n";
         }
 
+        // Rounds are contracted in parallel deterministically:
+        contraction contr1(g, {}, 1), contr3(g, {}, 3);
+        CHECK(contr1.contract() == contr3.contract());
+        CHECK(contr1.contraction_order() == contr3.contraction_order());
+
+        // Moving the graph in gives the same hierarchy:
+        contraction contr_mv(digraph(g), {}, 1);
+        CHECK(contr_mv.contract() == contr1.contract());
+        CHECK(contr_mv.contraction_order() == contr1.contraction_order());
+
+        // Paths in the original graph:
+        auto path_length = [&g](const std::vector<node> & p) {
+            dist len = 0;
+            for (std::size_t k = 0; k + 1 < p.size(); ++k) {
+                dist l = dist_max;
+                for (auto e : g.out_neighbors(p[k])) {
+                    if (e.dst == p[k+1] && e.len < l) { l = e.len; }
+                }
+                CHECK(l < dist_max); // an original edge
+                len = len + l;
+            }
+            return len;
+        };
+        std::vector<std::vector<node>> paths;
+        for (std::size_t i = 0; i < g.n() ; i += incr) {
+            node u(i);
+            for (std::size_t j = 0; j < g.n() ; j += incr) {
+                node v(j);
+                std::vector<node> p = contr1.path(u, v);
+                dist d = contr1.distance(u, v);
+                if (d == dist_max) { CHECK(p.empty()); }
+                else {
+                    CHECK(p.front() == u && p.back() == v);
+                    CHECK(path_length(p) == d);
+                }
+                paths.push_back(p);
+            }
+        }
+        contr1.cache_unpacked_shortcuts(g.n() / 2);
+        std::size_t ip = 0;
+        for (std::size_t i = 0; i < g.n() ; i += incr) {
+            for (std::size_t j = 0; j < g.n() ; j += incr) {
+                CHECK(contr1.path(node(i), node(j)) == paths[ip++]);
+            }
+        }
+
+        // Edge length updates on a full and on a partial hierarchy (see
+        // also test_edge_length_updates()):
+        for (float max_deg : {std::numeric_limits<float>::max(), 3.f}) {
+            contraction dyn(g);
+            dyn.contract(max_deg);
+            std::vector<edge> edges = g.no_loop().to_edges();
+            std::size_t nupd = 0;
+            std::chrono::microseconds upd_time(0);
+            for (std::size_t k = 0; k < edges.size();
+                 k += edges.size() / 7 + 1) {
+                const edge e = edges[k];
+                // increase, then decrease below the initial length:
+                for (std::uint_least32_t l :
+                         {3 * std::uint_least32_t(e.len) + 10,
+                          std::uint_least32_t(e.len) / 2}) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    CHECK(dyn.update_edge_length(e.src, e.dst, l));
+                    dyn.query_engine(); // patched or rebuilt
+                    upd_time += std::chrono::duration_cast
+                        <std::chrono::microseconds>
+                        (std::chrono::high_resolution_clock::now() - start);
+                    ++nupd;
+                }
+            }
+            std::cout <<"edge length updates: "<< nupd <<" in "
+                      << upd_time.count() / 1000 <<"ms\n";
+        }
+
+        // Limited witness searches:
+        contraction limited(g);
+        limited.set_witness_limits(20, 3);
+        std::size_t m_limited = limited.contract().m();
+        std::cout <<"limited witness searches: m="<< m_limited <<"\n";
+        CHECK(m_limited >= contr1.contract().m());
+        for (std::size_t i = 0; i < g.n() ; i += incr) {
+            node u(i);
+            trav.dijkstra(g, u);
+            for (std::size_t j = 0; j < g.n() ; j += incr) {
+                CHECK(limited.distance(u, node(j)) == trav.distance(node(j)));
+            }
+        }
+
+        // Lazy priority ordering:
+        contraction lazy(g);
+        lazy.set_ordering(contraction::ordering::lazy_priority);
+        lazy.contract(3);
+        const std::size_t m_lazy = lazy.contract().m();
+        const std::size_t m_rounds = contr1.contract().m();
+        std::cout <<"lazy priority ordering: m="<< m_lazy
+                  <<" (rounds: m="<< m_rounds <<")\n";
+        CHECK(m_lazy <= m_rounds); // fewer shortcuts
+        for (std::size_t i = 0; i < g.n() ; i += incr) {
+            node u(i);
+            trav.dijkstra(g, u);
+            for (std::size_t j = 0; j < g.n() ; j += incr) {
+                CHECK(lazy.distance(u, node(j)) == trav.distance(node(j)));
+            }
+        }
+
         }
         
     }
+
+    void test_edge_length_updates() {
+        // Small random graphs, all pairs are checked after each update:
+        std::mt19937_64 rng(7);
+        traversal<digraph> trav;
+        std::size_t nupd = 0;
+        for (std::size_t k = 0; k < 100; ++k) {
+            const std::size_t n = 10 + rng() % 30;
+            digraph g;
+            g.add_node(node(n - 1));
+            for (std::size_t i = 0; i < 3 * n; ++i) {
+                g.add_edge(node(rng() % n), node(rng() % n),
+                           edge_len(1 + rng() % 20));
+            }
+            contraction dyn(g);
+            dyn.contract(k % 2 == 0 ? std::numeric_limits<float>::max()
+                                    : 2.f); // full or partial
+            digraph h = g.no_loop();
+            h.merge_parallel_edges();
+            std::vector<edge> edges = h.to_edges();
+            for (std::size_t j = 0; j < 8 && ! edges.empty(); ++j) {
+                edge & e = edges[rng() % edges.size()];
+                // mostly increases:
+                e.len = j % 4 == 3 ? edge_len(e.len / 2)
+                                   : edge_len(std::uint_least32_t(e.len) + 1
+                                              + rng() % 40);
+                CHECK(dyn.update_edge_length(e.src, e.dst, e.len));
+                h.set_edge_length(e.src, e.dst, e.len);
+                ++nupd;
+                for (node s : h) {
+                    trav.dijkstra(h, s);
+                    for (node t : h) {
+                        CHECK(dyn.distance(s, t) == trav.distance(t));
+                    }
+                }
+            }
+            // Edges absent from the graph are reported:
+            for (node u : h) {
+                if (edge_length(h, u, node(0)) == dist_max && u != node(0)) {
+                    CHECK( ! dyn.update_edge_length(u, node(0), 1));
+                    break;
+                }
+            }
+        }
+        std::cout <<"random edge length updates: "<< nupd <<" checked\n";
+    }
 }
 
 }
@@ -4,47 +4,231 @@
 
 #include <vector>
 #include <queue>
-#include <set>
+#include <unordered_map>
 #include <algorithm>
+#include <thread>
 
 #include "basics.hh"
 #include "digraph.hh"
 #include "traversal.hh"
+#include "ch_query.hh"
+#include "edge_map.hh"
+#include "stats.hh"
 
 namespace ch {
 
 class contraction {
 
+public:
+
+    // How nodes are ordered for contraction:
+    enum class ordering {
+        // By rounds: an independent set of nodes with low fill degree
+        // (product of in and out degrees) is contracted in parallel.
+        rounds,
+        // One node at a time from a priority queue keyed by
+        // 2 * (4 * added - removed) + contracted neighbors + depth: its
+        // simulated edge difference (shortcuts added weigh four times the
+        // edges removed, as they all remain in the hierarchy) weighs twice
+        // its number of contracted neighbors and its search-space depth.
+        // Neighbors of a contracted node get an estimate with short witness
+        // searches, the priority of a popped node is recomputed exactly
+        // and it is pushed back if it is no more the minimum (slower than
+        // rounds, but fewer shortcuts and faster queries).
+        lazy_priority
+    };
+
 protected:
+    // Input edges and shortcuts, with each edge u->v stored twice: in
+    // fwd.out_neighbors(u) and in bwd.out_neighbors(v). Witness searches,
+    // in-neighbor scans, update_edge_length() and the construction of the
+    // index all need in-edges with their lengths: an in-edge index over a
+    // single store (source and position of each edge) would take 8 bytes
+    // per edge, as much as bwd itself.
     digraph fwd, bwd;
-    traversal<digraph> trav_fwd, trav_bwd;
-    std::set<node> contractible;
+
+    // Query engine for [fwd], built on first use after contract() and
+    // refreshed when needed after update_edge_length(): rebuilt if edges
+    // were added, otherwise the lengths of [changed_edges] are patched in
+    // a copy of its index.
+    ch_query query;
+    bool query_outdated;
+    std::vector<edge> changed_edges;
+    bool core_mode; // query with a core_table (see set_core_table())
+
+    // Witness searches of a round are run in parallel, each thread using
+    // its own workspace:
+    struct workspace {
+        traversal<digraph> trav;
+        traversal<digraph> bwd_trav; // for update_edge_length()
+        std::vector<edge> shortcuts;
+        // targets of the current witness searches, rather than an array of
+        // marks over all nodes:
+        std::vector<node> targets;
+        // counters of the current round (with CH_STATS defined):
+        std::uint64_t witness_searches = 0, witness_hits = 0;
+    };
+    std::vector<workspace> workspaces;
+
+    // Limits of witness searches:
+    std::size_t witness_max_settled;
+    unsigned witness_max_hops;
+    std::vector<bool> contractible; // not contracted and not kept
+    std::size_t nb_contractible;
     std::vector<node> contract_order;
     std::vector<bool> in_contracted_gr;
     std::vector<std::size_t> contract_rank;
     std::size_t current_rank;
     std::size_t n, m; // number of node and edges in current contracted graph
-    std::vector<std::size_t> in_degrees, out_degrees;
+    std::vector<std::uint_least32_t> in_degrees, out_degrees;
+
+    // For ordering::lazy_priority (arrays are allocated by set_ordering()):
+    ordering order;
+    using prio_node = std::pair<std::int64_t, node>;
+    std::priority_queue<prio_node, std::vector<prio_node>,
+                        std::greater<prio_node>> prio_queue; // min first
+    std::vector<std::int64_t> priority;
+    std::vector<std::uint_least32_t> contracted_neighbors, depth;
+
+    // Middle node of each shortcut u->v of [fwd]: the node whose
+    // contraction produced its current length (original edges with their
+    // original length are absent).
+    edge_map<node> middles;
+    // Unpacked shortcuts cached by cache_unpacked_shortcuts(): inner nodes
+    // of shortcut with key k are unpacked_nodes[beg..end) for
+    // unpacked[k] = {beg, end}.
+    std::unordered_map<std::uint64_t,
+                       std::pair<std::size_t, std::size_t>> unpacked;
+    std::vector<node> unpacked_nodes;
+
+    static std::uint64_t shortcut_key(node u, node v) {
+        return (std::uint64_t(u) << 32) | std::uint64_t(v);
+    }
+
+    // Original length of the edges u->v of the input graph that were
+    // shortened by a shortcut. Other edges of the input graph still have
+    // their original length in [fwd] (parallel edges are merged).
+    edge_map<edge_len> replaced_len;
+    // up_len_below[r]: maximum length of an upward edge (from or to a node
+    // of higher rank) of a node of rank less than r (an upper bound after
+    // updates, as lengths are only raised):
+    std::vector<dist> up_len_below;
+
+    // Raise up_len_below[] for an upward edge of length [l] of a node of
+    // rank [r].
+    void raise_up_len(std::size_t r, dist l) ;
+
+    // Position of edge [u]->[v] in fwd.out_neighbors(u) (its out-degree if
+    // absent).
+    std::size_t edge_pos(node u, node v) const ;
+
+    // Length of edge [u]->[v] in the input graph (infinity if absent).
+    dist original_length(node u, node v) const ;
+
+    // Counters (see stats.hh), [cur_round] is for the current round:
+    contraction_stats counters;
+    round_stats cur_round;
+
+    // Close current round: [cur_round] and workspace counters are collected.
+    void collect_round_stats(std::size_t ncontracted, double ms) ;
 
 public:
 
     // Prepare for contracting [g]. Nodes in [keep] will not be contracted.
-    contraction(const digraph &g, const std::vector<node> &keep = {}) ;
+    // Each round is contracted with [nb_threads] threads (0 means one per
+    // hardware thread). The result does not depend on [nb_threads].
+    contraction(const digraph &g, const std::vector<node> &keep = {},
+                std::size_t nb_threads = 0) ;
+
+    // Same without copying [g], which is moved in (for large graphs).
+    contraction(digraph &&g, const std::vector<node> &keep = {},
+                std::size_t nb_threads = 0) ;
+
+    // Set how next nodes will be ordered (ordering::rounds by default).
+    void set_ordering(ordering o) ;
+
+    // Limit witness searches to [max_settled] nodes and paths of
+    // [max_hops] edges (no limits by default). When a limit is hit before
+    // a witness path is found, the shortcut is added: distances remain
+    // exact but the hierarchy may have more edges.
+    void set_witness_limits(std::size_t max_settled, unsigned max_hops) ;
 
     // Contract nodes successively while average degree is bellow [max_avg_deg].
     digraph & contract(float max_avg_deg
                        = std::numeric_limits<float>::max()) ;
 
+    // Counters of each round of contract() and of witness searches (only
+    // incremented with CH_STATS defined, see stats.hh), and memory held by
+    // the graphs.
+    const contraction_stats & stats() const { return counters; }
+
     // Returns [true] if node [u] has not been contracted yet.
     bool in_contracted_graph(node u) const ;
 
     // Returns the order in which the nodes have been contracted.
     const std::vector<node> & contraction_order () const ;
 
-    // Returns the distance between two nodes. Efficient after most nodes have
-    // been contracted. (Not tested without full contraction.)
+    // Returns the rank of each node in the contraction order (nodes not
+    // contracted yet have rank n).
+    const std::vector<std::size_t> & contraction_ranks () const ;
+
+    // Returns the distance between two nodes (using the hierarchy obtained
+    // at the end of last call to contract(), whose query index is built on
+    // first use). Efficient after most nodes
+    // have been contracted, uncontracted nodes are searched as in a
+    // bidirectional Dijkstra unless a core table is used (see
+    // set_core_table()).
     dist distance(node src, node dst) ;
 
+    // Returns the matrix of distances from [sources] to [targets] (see
+    // ch_query::distance_table()).
+    std::vector<dist> distance_table(const std::vector<node> & sources,
+                                     const std::vector<node> & targets) ;
+
+    // When [use] is [true], distance() joins searches through a table of
+    // distances between uncontracted nodes (see core_table) after a
+    // partial contraction. The table is rebuilt with the query engine,
+    // and skipped when the core is too large for one (see
+    // core_table::max_core_size).
+    void set_core_table(bool use) ;
+
+    // The query engine used by distance().
+    ch_query & query_engine() ;
+
+    // The index of the hierarchy, which can be shared by threads each
+    // using its own ch_query context (see also ch_query_pool).
+    std::shared_ptr<const ch_index> query_index() ;
+
+    // Returns the nodes of a shortest path from [src] to [dst] in the
+    // original graph (empty if there is none). Shortcuts of the hierarchy
+    // path are unpacked recursively through their middle nodes.
+    std::vector<node> path(node src, node dst) ;
+
+    // Returns the middle node of edge [u]->[v] of the hierarchy, or an
+    // invalid node if it is an original edge.
+    node shortcut_middle(node u, node v) const ;
+
+    // Store the unpacking of all shortcuts between nodes of rank at least
+    // [min_rank] (see contraction_ranks()), so that path() does not
+    // recurse into them. High-level shortcuts are few but their
+    // unpacking is long. The cache is cleared by contract().
+    void cache_unpacked_shortcuts(std::size_t min_rank) ;
+
+    // Set the length of edge [u]->[v] of the input graph to [len] and
+    // update the hierarchy. Shortcuts whose length depends on it are
+    // recomputed in rank order from their middle nodes. Then witnesses
+    // are checked again with upward searches for pairs of neighbors of a
+    // node that may need a new shortcut: pairs around a decreased edge,
+    // and for an increase, pairs whose witness could go through an edge
+    // that got longer (found with Dijkstra balls around [u] and [v], whose
+    // radius is bounded by twice the longest upward edge of a node below
+    // these edges, see up_len_below). Such a pair may have an edge longer
+    // than its path through the node, which is then recomputed. The
+    // index of query_engine() is then patched with the new lengths, or
+    // rebuilt if shortcuts were added. Returns [false], changing nothing,
+    // if [u]->[v] is not an edge of the input graph (loops excluded).
+    bool update_edge_length(node u, node v, edge_len len) ;
+
 protected:
 
     struct vtx_deg {
@@ -61,14 +245,49 @@ protected:
     // Returns number of nodes contracted.
     std::size_t contract_round() ;
 
-    void contract_node(node u) ;
+    // Contract at most [count] nodes with ordering::lazy_priority while
+    // average degree is bellow [max_avg_deg]. Returns number of nodes
+    // contracted.
+    std::size_t contract_lazy(std::size_t count, float max_avg_deg) ;
+
+    // Priority of [u] for ordering::lazy_priority, simulating its
+    // contraction with [ws] (shortcuts are left in [ws.shortcuts]) and
+    // witness searches settling at most [max_settled] nodes.
+    std::int64_t simulated_priority(node u, workspace & ws,
+                                    std::size_t max_settled) const ;
+
+    // Rebuild [query] if outdated or not built yet.
+    void refresh_query() ;
+    // Build [query] for the current hierarchy.
+    void build_query() ;
+
+    // Call [f(i, ws)] for i = 0..count-1 using all workspaces in parallel.
+    template <typename F>
+    void parallel_for(std::size_t count, F f) ;
+
+    // Append to [ws.shortcuts] the edges to add when contracting [u].
+    // Witness paths avoid [u] and all nodes not in the contracted graph,
+    // including the nodes contracted in the same round. One witness search
+    // is made from each in-neighbor of [u] to all its out-neighbors,
+    // settling at most [max_settled] nodes (and witness_max_settled).
+    void contraction_shortcuts(node u, workspace & ws,
+                               std::size_t max_settled
+                               = std::numeric_limits<std::size_t>::max())
+        const ;
+
+    // Remove [u] from the contracted graph and add edges [shortcuts].
+    using erange = crange<std::vector<edge>>;
+    void contract_node(node u, erange shortcuts) ;
 
-    // Try to update an edge is present. Return true if not.
-    bool cannot_update_edge(node u, node v, dist l) ;    
+    // Append to [p] the nodes of the original path of edge [u]->[v] of the
+    // hierarchy, excluding [u] (including [v] iff [with_v] is true).
+    void unpack_edge(node u, node v, std::vector<node> & p,
+                     bool with_v = true) const ;
 };
 
 namespace unit {
     void test_contraction();
+    void test_edge_length_updates();
 }
 
 }
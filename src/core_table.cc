@@ -0,0 +1,90 @@
+#include <thread>
+
+#include "core_table.hh"
+#include "parallel.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+// Size of the core of [ix], which must fit in a table.
+static std::size_t table_size(const ch_index & ix) {
+    CHECK(ix.core_size() <= core_table::max_core_size);
+    return ix.core_size();
+}
+
+core_table::core_table(const ch_index & ix, std::size_t nb_threads)
+    : size(table_size(ix)), dists(size * size, dist_max)
+{
+    if (nb_threads == 0) {
+        nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Upward edges of core nodes only lead to core nodes: a Dijkstra in
+    // up_fwd from a core node stays in the core.
+    const static_digraph & up_fwd = ix.upward_fwd();
+    std::vector<traversal<static_digraph>> travs(nb_threads);
+    parallel_for(size, nb_threads, [this, &up_fwd, &travs](std::size_t i,
+                                                           std::size_t t) {
+            traversal<static_digraph> & trav = travs[t];
+            trav.dijkstra(up_fwd, node(i));
+            std::uint_least32_t *row = dists.data() + i * size;
+            for (node j : trav.settled_nodes()) {
+                assert(j < size);
+                row[j] = trav.distance(j);
+            }
+        });
+}
+
+namespace unit {
+
+    void test_core_table() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            // The small graph is not contracted at all with 1.f:
+            for (float max_deg : {std::numeric_limits<float>::max(),
+                                  g.n() > 1000 ? 3.f : 1.f, 4.f}) {
+                contraction contr(g);
+                contr.contract(max_deg); // full or partial
+                ch_query q = contr.query_engine();
+                auto table = std::make_shared<core_table>(*q.index());
+                CHECK(table->core_size() == q.index()->core_size());
+                if (max_deg == std::numeric_limits<float>::max()) {
+                    CHECK(table->core_size() == 0);
+                }
+                std::cout <<"core: "<< table->core_size() <<" nodes\n";
+                q.set_core_table(table);
+                traversal<digraph> trav;
+                const std::size_t incr = std::max(std::size_t(1), g.n() / 20);
+                for (std::size_t i = 0; i < g.n(); i += incr) {
+                    node u(i);
+                    trav.dijkstra(g, u);
+                    for (node v : g) {
+                        CHECK(q.distance(u, v) == trav.distance(v));
+                    }
+                }
+                // Core mode settles fewer nodes than plain searches:
+                ch_query plain(q.index());
+                std::size_t settled = 0, plain_settled = 0;
+                for (std::size_t i = 0; i + incr < g.n(); i += incr) {
+                    const node u(i), v(i + incr);
+                    CHECK(q.distance(u, v) == plain.distance(u, v));
+                    settled += q.nb_settled();
+                    plain_settled += plain.nb_settled();
+                }
+                CHECK(settled <= plain_settled);
+                // Through the contraction:
+                contr.set_core_table(true);
+                for (node v : g) {
+                    CHECK(contr.distance(node(0), v)
+                          == plain.distance(node(0), v));
+                }
+                CHECK(contr.query_engine().core_distances()
+                      || table->core_size() == 0);
+                contr.set_core_table(false);
+                CHECK( ! contr.query_engine().core_distances());
+            }
+        }
+    }
+
+}
+
+}
@@ -0,0 +1,64 @@
+// Distances between the uncontracted nodes of a partial hierarchy.
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+#include "ch_query.hh"
+
+namespace ch {
+
+/** When contraction stops early (see contraction::contract()), the
+ * uncontracted nodes (the core) share the maximal rank and are linked by
+ * edges in both directions of the index: a plain query then explores the
+ * core as a bidirectional Dijkstra would. The table stores the distance
+ * between any two core nodes instead, computed once with a Dijkstra from
+ * each core node restricted to the core (the core graph preserves the
+ * distances between its nodes).
+ *
+ * With a table, ch_query::distance() stops both upward searches at core
+ * nodes (the entry points) and joins them through the table: the distance
+ * is the minimum of d(src, a) + table(a, b) + d(b, dst) over entry points
+ * a of the forward search and b of the backward search, or of a meeting
+ * below the core. The table has core_size()^2 entries: contraction should
+ * go far enough for it to fit in memory.
+ *
+ * Core nodes are the first internal ids of the index (see
+ * ch_index::core_size()). A table is never modified and can be shared by
+ * several query contexts of the same index.
+ */
+class core_table {
+
+protected:
+    std::size_t size;
+    std::vector<std::uint_least32_t> dists; // row by row
+
+public:
+
+    // Largest core with a table (1.6GB for 20000 nodes).
+    static constexpr std::size_t max_core_size = 20000;
+
+    // Table of the core of [ix], computed with [nb_threads] threads (0
+    // means one per hardware thread). The core must have at most
+    // max_core_size nodes.
+    explicit core_table(const ch_index & ix, std::size_t nb_threads = 0) ;
+
+    std::size_t core_size() const { return size; }
+
+    // Distance from core node [i] to core node [j] (internal ids).
+    dist distance(node i, node j) const {
+        return dist(dists[std::size_t(i) * size + j]);
+    }
+
+    // Memory held by the table.
+    std::size_t memory_bytes() const {
+        return dists.capacity() * sizeof(std::uint_least32_t);
+    }
+};
+
+namespace unit {
+    void test_core_table();
+}
+
+}
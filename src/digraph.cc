@@ -23,6 +23,14 @@ bool digraph::update_edge(node u, node v, edge_len l) {
     return true;
 }
 
+std::size_t digraph::set_edge_length(node u, node v, edge_len l) {
+    std::size_t nb = 0;
+    for (head & hd : out_neighb[u]) {
+        if (hd.dst == v) { hd.len = l; ++nb; }
+    }
+    return nb;
+}
+
 digraph::hrange digraph::out_neighbors(node u) const {
     assert(u >= 0 && u < _n);
     return hrange(out_neighb[u].cbegin(), out_neighb[u].cend());
@@ -101,6 +109,12 @@ digraph digraph::reverse() const {
     return bwd;
 }
 
+digraph::digraph(std::vector<std::vector<head>> && adj)
+    : out_neighb(std::move(adj)), _n(out_neighb.size()), _m(0)
+{
+    for (const auto & nb : out_neighb) { _m += nb.size(); }
+}
+
 digraph digraph::no_loop() const {
     digraph g;
     if (_n > 0) { g.add_node(node(_n-1u)); }
@@ -112,6 +126,66 @@ digraph digraph::no_loop() const {
     return g;
 }
 
+std::size_t digraph::memory_bytes() const {
+    std::size_t bytes = sizeof(*this)
+        + out_neighb.capacity() * sizeof(std::vector<head>);
+    for (const auto & nb : out_neighb) { bytes += nb.capacity() * sizeof(head); }
+    return bytes;
+}
+
+void digraph::remove_loops() {
+    for (node u : nodes()) {
+        auto & nb = out_neighb[u];
+        const std::size_t deg = nb.size();
+        nb.erase(std::remove_if(nb.begin(), nb.end(),
+                                [u](const head & hd) { return hd.dst == u; }),
+                 nb.end());
+        _m -= deg - nb.size();
+    }
+}
+
+std::size_t digraph::merge_parallel_edges() {
+    const std::size_t m = _m;
+    for (auto & nb : out_neighb) {
+        _m -= nb.size();
+        merge_parallel(nb);
+        _m += nb.size();
+    }
+    return m - _m;
+}
+
+void digraph::merge_parallel(std::vector<head> & nb) {
+    std::size_t k = 0;
+    if (nb.size() <= 64) { // quadratic scan of short lists
+        for (std::size_t i = 0; i < nb.size(); ++i) {
+            std::size_t j = 0;
+            while (j < k && nb[j].dst != nb[i].dst) { ++j; }
+            if (j < k) { nb[j].len = std::min(nb[j].len, nb[i].len); }
+            else { nb[k++] = nb[i]; }
+        }
+    } else { // positions sorted by head, first occurrence first
+        std::vector<std::size_t> pos(nb.size());
+        for (std::size_t i = 0; i < nb.size(); ++i) { pos[i] = i; }
+        std::stable_sort(pos.begin(), pos.end(), [&nb](std::size_t a,
+                                                       std::size_t b) {
+                return nb[a].dst < nb[b].dst;
+            });
+        std::vector<bool> keep(nb.size(), false);
+        for (std::size_t i = 0; i < pos.size(); ) {
+            std::size_t j = i + 1;
+            for ( ; j < pos.size() && nb[pos[j]].dst == nb[pos[i]].dst; ++j) {
+                nb[pos[i]].len = std::min(nb[pos[i]].len, nb[pos[j]].len);
+            }
+            keep[pos[i]] = true;
+            i = j;
+        }
+        for (std::size_t i = 0; i < nb.size(); ++i) {
+            if (keep[i]) { nb[k++] = nb[i]; }
+        }
+    }
+    nb.resize(k, head(node(0), 0));
+}
+
 std::pair<digraph, std::vector<node>>
 digraph::subgraph(std::function<bool(node)> filter) {
     const node invalid = node(_n);
@@ -194,6 +268,22 @@ namespace unit {
         std::sort(edges.begin(), edges.end());
         std::sort(hedg.begin(), hedg.end());
         CHECK(edges == hedg);
+
+        // Merging parallel edges (short and long out-neighbor lists):
+        for (std::size_t deg : {10, 200}) {
+            digraph p;
+            for (std::size_t i = 0; i < deg; ++i) {
+                p.add_edge(node(0), node(1 + (i * 7) % 5), edge_len(deg - i));
+            }
+            CHECK(p.merge_parallel_edges() == deg - 5 && p.m() == 5);
+            std::vector<node> heads;
+            for (auto e : p.out_neighbors(node(0))) {
+                heads.push_back(e.dst);
+                CHECK(e.len <= 5); // minimum of each class
+            }
+            CHECK(heads == std::vector<node>({node(1), node(3), node(5),
+                                              node(2), node(4)}));
+        }
     }
     
 }
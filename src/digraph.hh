@@ -61,6 +61,10 @@ public:
 
     digraph() : _n(0), _m(0) {}
 
+    // Graph with out-neighbors [adj[u]] for each node u (see
+    // digraph_builder.hh).
+    explicit digraph(std::vector<std::vector<head>> && adj) ;
+
     std::size_t nb_nodes() const { return _n; }
     std::size_t n() const { return _n; } // almost standard
 
@@ -68,6 +72,9 @@ public:
     std::size_t m() const { return _m; } // almost standard
 
     std::size_t out_degree(node u) const { return out_neighb[u].size(); }
+
+    // Memory held by the graph (allocated capacity).
+    std::size_t memory_bytes() const ;
     
     void add_node(node u) {
         if (u >= _n) {
@@ -94,6 +101,10 @@ public:
     // length [l].
     // Returns true if the edge was added;
     bool update_edge(node src, node dst, edge_len l) ;
+
+    // Set the length of all edges src->dst to [l].
+    // Returns the number of such edges.
+    std::size_t set_edge_length(node src, node dst, edge_len l) ;
     
     irange<node> nodes() const { return irange<node>(node(0), node(_n)); }
     
@@ -117,6 +128,13 @@ public:
     bool operator==(const digraph & o) ;
     digraph reverse() const ;
     digraph no_loop() const ;
+    void remove_loops() ; // in place
+
+    // Keep one edge u->v (with minimum length) among parallel edges, in
+    // place. Returns the number of edges removed.
+    std::size_t merge_parallel_edges() ;
+    // Same for a list of out-neighbors (order of first occurrences is kept).
+    static void merge_parallel(std::vector<head> & nb) ;
 
     // Compute  a subgraph (nodes are re-indexed) :
     std::pair<digraph, std::vector<node>>
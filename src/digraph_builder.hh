@@ -0,0 +1,125 @@
+// Building a digraph from a stream of edges.
+
+#pragma once
+
+#include <vector>
+#include <thread>
+
+#include "basics.hh"
+#include "digraph.hh"
+#include "parallel.hh"
+
+namespace ch {
+
+/** Edges come in batches (e.g. chunks of a file parsed in parallel) that
+ * are consumed:
+ *  - each batch is reordered by range of source nodes (stably, by one
+ *    thread per batch), so that the edges of each (range, batch) are
+ *    contiguous;
+ *  - the out-degree of each node is counted by one thread per range, and
+ *    adjacency vectors are allocated once with their final size;
+ *  - batches are then appended one after the other to adjacency vectors
+ *    (by one thread per range), each batch being freed as soon as it is
+ *    copied.
+ * Out-neighbors of each node thus come in input order whatever the number
+ * of threads, and edges are held at most once in batches and once in the
+ * graph (plus a copy of a batch per thread while reordering). Parallel
+ * edges can be merged at build time (keeping the minimum length).
+ *
+ * Example:
+ *
+ *    std::vector<std::vector<edge>> batches = ...;
+ *    digraph g = digraph_builder(n).build(batches); // batches are emptied
+ */
+class digraph_builder {
+
+    std::size_t n, nb_threads;
+
+public:
+
+    // Builder of graphs with nodes 0..n-1, using [nb_threads] threads (0
+    // means one per hardware thread).
+    explicit digraph_builder(std::size_t n, std::size_t nb_threads = 0)
+        : n(n), nb_threads(nb_threads > 0 ? nb_threads
+                           : std::max(1u, std::thread::hardware_concurrency()))
+    {}
+
+    // Graph of the edges of [batches] in batch order, [batches] are emptied.
+    // Parallel edges are merged when [merge_parallel] is [true].
+    digraph build(std::vector<std::vector<edge>> & batches,
+                  bool merge_parallel = true) const {
+        const std::size_t nb_batches = batches.size();
+        // Ranges of source nodes, a few per thread for balance:
+        const std::size_t nr = std::max(std::size_t(1),
+                                        std::min(4 * nb_threads, n / 4096));
+        auto range = [this, nr](node u) {
+            return std::size_t(std::uint64_t(u) * nr / n);
+        };
+        auto range_begin = [this, nr](std::size_t r) { // first u of range r
+            return std::size_t((std::uint64_t(r) * n + nr - 1) / nr);
+        };
+
+        // Reorder each batch by range, seg[b][r] is where range r begins:
+        std::vector<std::vector<std::size_t>> seg(nb_batches);
+        parallel_for(nb_batches, nb_threads, [this, nr, &batches, &seg,
+                                              &range](std::size_t b,
+                                                      std::size_t) {
+                std::vector<edge> & batch = batches[b];
+                std::vector<std::size_t> & beg = seg[b];
+                beg.assign(nr + 1, 0);
+                for (const edge & e : batch) {
+                    CHECK(e.src < n && e.dst < n);
+                    ++beg[range(e.src) + 1];
+                }
+                for (std::size_t r = 0; r < nr; ++r) { beg[r+1] += beg[r]; }
+                if (nr == 1) return;
+                std::vector<std::size_t> pos(beg.begin(), beg.end() - 1);
+                std::vector<edge> sorted(batch.size(), edge(node(0), node(0)));
+                for (const edge & e : batch) { sorted[pos[range(e.src)]++] = e; }
+                batch.swap(sorted);
+            });
+
+        // Adjacency vectors with their final size:
+        std::vector<std::vector<edge_head>> adj(n);
+        parallel_for(nr, nb_threads, [nb_batches, &batches, &seg, &adj,
+                                      &range_begin](std::size_t r,
+                                                    std::size_t) {
+                const std::size_t beg = range_begin(r), end = range_begin(r+1);
+                std::vector<std::uint_least32_t> count(end - beg, 0);
+                for (std::size_t b = 0; b < nb_batches; ++b) {
+                    for (std::size_t i = seg[b][r]; i < seg[b][r+1]; ++i) {
+                        ++count[std::size_t(batches[b][i].src) - beg];
+                    }
+                }
+                for (std::size_t u = beg; u < end; ++u) {
+                    adj[u].reserve(count[u - beg]);
+                }
+            });
+
+        // Copy batches in order:
+        for (std::size_t b = 0; b < nb_batches; ++b) {
+            parallel_for(nr, nb_threads, [b, &batches, &seg,
+                                          &adj](std::size_t r, std::size_t) {
+                    for (std::size_t i = seg[b][r]; i < seg[b][r+1]; ++i) {
+                        const edge & e = batches[b][i];
+                        adj[e.src].push_back(e);
+                    }
+                });
+            std::vector<edge>().swap(batches[b]); // free memory
+        }
+
+        if (merge_parallel) {
+            parallel_for(nr, nb_threads, [&adj,
+                                          &range_begin](std::size_t r,
+                                                        std::size_t) {
+                    for (std::size_t u = range_begin(r);
+                         u < range_begin(r+1); ++u) {
+                        digraph::merge_parallel(adj[u]);
+                    }
+                });
+        }
+        return digraph(std::move(adj));
+    }
+};
+
+}
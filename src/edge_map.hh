@@ -0,0 +1,121 @@
+// Compact map from edges to values.
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+
+namespace ch {
+
+/** Open addressing hash table (linear probing) of values of type [V]
+ * attached to edges u->v, stored in a single array of slots {u, v, value}
+ * (12 bytes for a 4 bytes value). The number of slots is a power of 2,
+ * at most 4/3 times the number of entries before doubling. Erasing an
+ * entry shifts back the following entries of its cluster, so that there
+ * are no tombstones.
+ *
+ * Example:
+ *
+ *    edge_map<node> mid;
+ *    mid.set(node(0), node(1), node(7));
+ *    const node *m = mid.find(node(0), node(1)); // *m == node(7)
+ */
+template <typename V>
+class edge_map {
+
+    struct entry {
+        node src, dst; // src invalid for an empty slot
+        V val;
+    };
+    std::vector<entry> slots;
+    std::size_t count;
+    unsigned shift; // 64 - log2(number of slots)
+
+    // Fibonacci hashing of u->v:
+    std::size_t slot(node u, node v) const {
+        const std::uint64_t key = (std::uint64_t(u) << 32) | std::uint64_t(v);
+        return std::size_t((key * 0x9e3779b97f4a7c15ULL) >> shift);
+    }
+
+    // Slot of u->v, or of the empty slot where it would be inserted.
+    std::size_t find_slot(node u, node v) const {
+        const std::size_t mask = slots.size() - 1;
+        std::size_t s = slot(u, v);
+        while (slots[s].src.valid()
+               && (slots[s].src != u || slots[s].dst != v)) {
+            s = (s + 1) & mask;
+        }
+        return s;
+    }
+
+    void rehash(std::size_t nb_slots) {
+        std::vector<entry> old(nb_slots, entry{ node(), node(), V() });
+        old.swap(slots);
+        shift = 64;
+        for (std::size_t n = nb_slots; n > 1; n /= 2) { --shift; }
+        for (const entry & e : old) {
+            if (e.src.valid()) { slots[find_slot(e.src, e.dst)] = e; }
+        }
+    }
+
+public:
+
+    edge_map() { clear(); }
+
+    std::size_t size() const { return count; }
+
+    // Value of u->v, nullptr if absent.
+    const V * find(node u, node v) const {
+        const entry & e = slots[find_slot(u, v)];
+        return e.src.valid() ? &e.val : nullptr;
+    }
+
+    // Set the value of u->v, adding it if absent.
+    void set(node u, node v, V val) {
+        const std::size_t s = find_slot(u, v);
+        if (slots[s].src.valid()) { slots[s].val = val; return; }
+        slots[s] = entry{ u, v, val };
+        if (4 * ++count > 3 * slots.size()) { rehash(2 * slots.size()); }
+    }
+
+    // Remove u->v if present. Returns [true] if it was.
+    bool erase(node u, node v) {
+        const std::size_t mask = slots.size() - 1;
+        std::size_t s = find_slot(u, v);
+        if ( ! slots[s].src.valid()) return false;
+        --count;
+        // Move back entries that can no more be reached past the hole:
+        for (std::size_t t = (s + 1) & mask; slots[t].src.valid();
+             t = (t + 1) & mask) {
+            const std::size_t h = slot(slots[t].src, slots[t].dst);
+            if (((t - h) & mask) >= ((t - s) & mask)) {
+                slots[s] = slots[t];
+                s = t;
+            }
+        }
+        slots[s].src = node();
+        return true;
+    }
+
+    void clear() {
+        count = 0;
+        slots.clear();
+        rehash(16);
+    }
+
+    // Call [f(u, v, val)] for each entry (in no particular order).
+    template <typename F> // callable as void(node, node, const V &)
+    void for_each(F f) const {
+        for (const entry & e : slots) {
+            if (e.src.valid()) { f(e.src, e.dst, e.val); }
+        }
+    }
+
+    // Memory held by the map (allocated capacity).
+    std::size_t memory_bytes() const {
+        return sizeof(*this) + slots.capacity() * sizeof(entry);
+    }
+};
+
+}
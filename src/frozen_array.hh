@@ -0,0 +1,50 @@
+// Immutable array whose memory is either owned (moved from a vector) or
+// borrowed from an external buffer such as a memory-mapped file. Copies
+// share the same memory, which is released with the last copy.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cassert>
+
+namespace ch {
+
+template<typename T>
+class frozen_array {
+    std::shared_ptr<const void> owner; // keeps [_data] alive
+    const T *_data;
+    std::size_t _size;
+
+public:
+    using value_type = T;
+    using const_iterator = const T *;
+
+    frozen_array() : _data(nullptr), _size(0) {}
+
+    frozen_array(std::vector<T> && v) {
+        auto p = std::make_shared<const std::vector<T>>(std::move(v));
+        _data = p->data();
+        _size = p->size();
+        owner = std::move(p);
+    }
+
+    // View [size] elements at [data] which remain valid as long as [owner].
+    frozen_array(std::shared_ptr<const void> owner,
+                 const T *data, std::size_t size)
+        : owner(std::move(owner)), _data(data), _size(size) {}
+
+    std::size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const T *data() const { return _data; }
+    const T & operator[](std::size_t i) const {
+        assert(i < _size);
+        return _data[i];
+    }
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _size; }
+    const_iterator cbegin() const { return _data; }
+    const_iterator cend() const { return _data + _size; }
+};
+
+}
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <type_traits>
+
+#include "hierarchy_file.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+static_assert(sizeof(node) == 4 && sizeof(edge_head) == 8
+              && std::is_standard_layout<edge_head>::value,
+              "hierarchy file layout assumes packed 32 bits nodes and lengths");
+
+constexpr char hierarchy_header::magic_string[8];
+
+static std::uint64_t align8(std::uint64_t pos) { return (pos + 7) & ~7ull; }
+
+// Position of each array in the file, in the order of the layout.
+struct hierarchy_layout {
+    std::uint64_t rank, internal, external;
+    std::uint64_t fwd_offsets, fwd_heads, bwd_offsets, bwd_heads;
+    std::uint64_t label_offsets, label_order, label_chars, end;
+
+    hierarchy_layout(const hierarchy_header & h) {
+        const std::uint64_t off_size = (h.n + 1) * sizeof(std::uint64_t);
+        rank = align8(sizeof(hierarchy_header));
+        internal = align8(rank + h.n * sizeof(ch_query::rank_t));
+        external = align8(internal + h.n * sizeof(node));
+        fwd_offsets = align8(external + h.n * sizeof(node));
+        fwd_heads = align8(fwd_offsets + off_size);
+        bwd_offsets = align8(fwd_heads + h.m_fwd * sizeof(edge_head));
+        bwd_heads = align8(bwd_offsets + off_size);
+        label_offsets = align8(bwd_heads + h.m_bwd * sizeof(edge_head));
+        if (h.has_labels) {
+            label_order = align8(label_offsets + off_size);
+            label_chars = align8(label_order + h.n * sizeof(node));
+            end = label_chars + h.label_bytes;
+        } else {
+            label_order = label_chars = end = label_offsets;
+        }
+    }
+};
+
+void save_hierarchy(const std::string & fname, const ch_query & q,
+                    const label_dict & labels) {
+    CHECK(labels.size() == 0 || labels.size() == q.nb_nodes());
+    hierarchy_header h;
+    std::memcpy(h.magic, hierarchy_header::magic_string, sizeof(h.magic));
+    h.version = hierarchy_header::current_version;
+    h.byte_order = hierarchy_header::byte_order_mark;
+    h.n = q.nb_nodes();
+    h.m_fwd = q.upward_fwd().nb_edges();
+    h.m_bwd = q.upward_bwd().nb_edges();
+    h.has_labels = labels.size() == 0 ? 0 : 1;
+    h.label_bytes = 0;
+    for (std::size_t i = 0; i < labels.size(); ++i) {
+        h.label_bytes += labels.label(node(i)).size();
+    }
+    hierarchy_layout lay(h);
+    h.file_size = lay.end;
+
+    std::ofstream out(fname, std::ios::binary | std::ios::trunc);
+    CHECK(out.is_open());
+    auto write_at = [&out](std::uint64_t pos, const void *data,
+                           std::size_t size) {
+        static const char zeros[8] = {0};
+        const std::uint64_t cur = out.tellp();
+        CHECK(cur <= pos && pos < cur + 8);
+        out.write(zeros, pos - cur); // padding
+        out.write(static_cast<const char *>(data), size);
+    };
+    auto write_array = [&write_at](std::uint64_t pos, const auto & a) {
+        write_at(pos, a.data(), a.size() * sizeof(*a.data()));
+    };
+    write_at(0, &h, sizeof(h));
+    write_array(lay.rank, q.ranks());
+    const ch_index & ix = *q.index();
+    if (ix.internal_ids().size() == h.n) {
+        write_array(lay.internal, ix.internal_ids());
+        write_array(lay.external, ix.external_ids());
+    } else { // identity
+        std::vector<node> ids;
+        for (std::size_t i = 0; i < h.n; ++i) { ids.push_back(node(i)); }
+        write_array(lay.internal, ids);
+        write_array(lay.external, ids);
+    }
+    write_array(lay.fwd_offsets, q.upward_fwd().offset_array());
+    write_array(lay.fwd_heads, q.upward_fwd().head_array());
+    write_array(lay.bwd_offsets, q.upward_bwd().offset_array());
+    write_array(lay.bwd_heads, q.upward_bwd().head_array());
+    if (h.has_labels) {
+        std::vector<std::uint64_t> offs(1, 0);
+        std::vector<node> order;
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            offs.push_back(offs.back() + labels.label(node(i)).size());
+            order.push_back(node(i));
+        }
+        std::sort(order.begin(), order.end(), [&labels](node a, node b) {
+                return labels.label(a) < labels.label(b);
+            });
+        write_array(lay.label_offsets, offs);
+        write_array(lay.label_order, order);
+        write_at(lay.label_chars, nullptr, 0);
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            const std::string lab = labels.label(node(i));
+            out.write(lab.data(), lab.size());
+        }
+    }
+    CHECK(std::uint64_t(out.tellp()) == h.file_size);
+    out.close();
+    CHECK( ! out.fail());
+}
+
+// Array of [size] elements of type T at position [pos] in [file] (which
+// must contain it: the file may be truncated or corrupt).
+template <typename T>
+static frozen_array<T> mapped_array(const std::shared_ptr<const mapped_file> & file,
+                                    std::uint64_t pos, std::uint64_t size) {
+    CHECK(pos % alignof(T) == 0 && pos <= file->size());
+    CHECK(size <= (file->size() - pos) / sizeof(T)); // no overflow
+    return frozen_array<T>(file, reinterpret_cast<const T *>
+                           (file->data() + pos), size);
+}
+
+// Check that [offsets] start at 0, never decrease and end at [last].
+static void check_offsets(const frozen_array<std::uint64_t> & offsets,
+                          std::uint64_t last) {
+    CHECK(offsets.size() > 0 && offsets[0] == 0);
+    for (std::size_t i = 1; i < offsets.size(); ++i) {
+        CHECK(offsets[i-1] <= offsets[i]);
+    }
+    CHECK(offsets[offsets.size() - 1] == last);
+}
+
+// Check that heads of edges [heads] are nodes less than [n].
+static void check_heads(const frozen_array<edge_head> & heads, std::uint64_t n) {
+    for (const edge_head & hd : heads) { CHECK(std::uint64_t(hd.dst) < n); }
+}
+
+// Check that [perm] is a permutation of 0..n-1 with inverse [inv].
+static void check_permutation(const frozen_array<node> & perm,
+                              const frozen_array<node> & inv) {
+    const std::uint64_t n = perm.size();
+    CHECK(inv.size() == n);
+    for (std::size_t i = 0; i < n; ++i) {
+        CHECK(std::uint64_t(perm[i]) < n && inv[perm[i]] == node(i));
+    }
+}
+
+hierarchy_file::hierarchy_file(const std::string & fname)
+    : file(std::make_shared<const mapped_file>(fname)) {
+    CHECK(file->size() >= sizeof(hierarchy_header));
+    std::memcpy(&header, file->data(), sizeof(header));
+    CHECK(std::memcmp(header.magic, hierarchy_header::magic_string,
+                      sizeof(header.magic)) == 0);
+    CHECK(header.version == hierarchy_header::current_version);
+    CHECK(header.byte_order == hierarchy_header::byte_order_mark);
+    CHECK(header.file_size == file->size());
+    // Each array fits in the file, so that the layout cannot overflow:
+    const std::uint64_t fsize = header.file_size;
+    CHECK(header.n < fsize / sizeof(std::uint64_t));
+    CHECK(header.m_fwd <= fsize / sizeof(edge_head));
+    CHECK(header.m_bwd <= fsize / sizeof(edge_head));
+    CHECK(header.label_bytes <= fsize);
+    hierarchy_layout lay(header);
+    CHECK(lay.end == header.file_size);
+
+    using rank_t = ch_query::rank_t;
+    using offset = static_digraph::offset;
+    const std::uint64_t n = header.n;
+    frozen_array<offset> fwd_offsets
+        = mapped_array<offset>(file, lay.fwd_offsets, n + 1);
+    frozen_array<offset> bwd_offsets
+        = mapped_array<offset>(file, lay.bwd_offsets, n + 1);
+    frozen_array<edge_head> fwd_heads
+        = mapped_array<edge_head>(file, lay.fwd_heads, header.m_fwd);
+    frozen_array<edge_head> bwd_heads
+        = mapped_array<edge_head>(file, lay.bwd_heads, header.m_bwd);
+    frozen_array<rank_t> rank = mapped_array<rank_t>(file, lay.rank, n);
+    frozen_array<node> internal = mapped_array<node>(file, lay.internal, n);
+    frozen_array<node> external = mapped_array<node>(file, lay.external, n);
+    // Values used as indexes by queries (O(n+m), pages are read once):
+    check_offsets(fwd_offsets, header.m_fwd);
+    check_offsets(bwd_offsets, header.m_bwd);
+    check_heads(fwd_heads, n);
+    check_heads(bwd_heads, n);
+    for (std::size_t i = 0; i < n; ++i) { // by decreasing rank, at most n
+        CHECK(rank[i] <= n && (i == 0 || rank[i] <= rank[i-1]));
+    }
+    check_permutation(internal, external);
+    engine = ch_query(rank, static_digraph(fwd_offsets, fwd_heads),
+                      static_digraph(bwd_offsets, bwd_heads),
+                      internal, external);
+    if (has_labels()) {
+        label_offsets = mapped_array<std::uint64_t>(file, lay.label_offsets,
+                                                    n + 1);
+        label_order = mapped_array<node>(file, lay.label_order, n);
+        label_chars = mapped_array<char>(file, lay.label_chars,
+                                         header.label_bytes);
+        check_offsets(label_offsets, header.label_bytes);
+        std::vector<bool> seen(n, false);
+        for (node u : label_order) {
+            CHECK(std::uint64_t(u) < n && ! seen[u]);
+            seen[u] = true;
+        }
+    }
+}
+
+std::string_view hierarchy_file::label(node u) const {
+    assert(has_labels() && u < nb_nodes());
+    return std::string_view(label_chars.data() + label_offsets[u],
+                            label_offsets[u+1u] - label_offsets[u]);
+}
+
+node hierarchy_file::index(std::string_view lab) const {
+    if ( ! has_labels()) { return node(); }
+    auto it = std::lower_bound(label_order.begin(), label_order.end(), lab,
+                               [this](node u, std::string_view l) {
+                                   return label(u) < l;
+                               });
+    if (it != label_order.end() && label(*it) == lab) { return *it; }
+    return node();
+}
+
+
+namespace unit {
+
+    void test_hierarchy_file() {
+        contraction contr(dg_road);
+        contr.contract();
+        ch_query & q = contr.query_engine();
+        std::string fname = "/tmp/ch_unit_test_hierarchy.bin";
+        save_hierarchy(fname, q, edges_road.labels);
+
+        hierarchy_file hf(fname);
+        CHECK(hf.nb_nodes() == dg_road.nb_nodes() && hf.has_labels());
+        ch_query mq = hf.query();
+        CHECK(mq.nb_edges() == q.nb_edges());
+        for (node u : dg_road) {
+            CHECK(hf.label(u) == edges_road.labels[u]);
+            CHECK(hf.index(edges_road.labels[u]) == u);
+        }
+        CHECK( ! hf.index("not a label").valid());
+        const std::size_t incr = dg_road.n() / 30;
+        for (std::size_t i = 0; i < dg_road.n(); i += incr) {
+            for (std::size_t j = 0; j < dg_road.n(); j += incr) {
+                CHECK(mq.distance(node(i), node(j))
+                      == q.distance(node(i), node(j)));
+            }
+        }
+
+        // without labels:
+        save_hierarchy(fname, q);
+        hierarchy_file hf2(fname);
+        CHECK( ! hf2.has_labels() && ! hf2.index("50532632").valid());
+        std::remove(fname.c_str());
+    }
+
+}
+
+}
@@ -0,0 +1,83 @@
+// Binary file format for a finished contraction hierarchy.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "basics.hh"
+#include "frozen_array.hh"
+#include "mapped_file.hh"
+#include "ch_query.hh"
+#include "label_dict.hh"
+
+namespace ch {
+
+/** The file contains a header followed by arrays, each starting at a
+ * multiple of 8 bytes:
+ *   rank[n]                 (uint32)
+ *   internal[n], external[n] (uint32) node renumbering (see ch_index)
+ *   up_fwd offsets[n+1]     (uint64), up_fwd heads[m_fwd] (dst, len uint32)
+ *   up_bwd offsets[n+1]     (uint64), up_bwd heads[m_bwd]
+ * and when labels are present:
+ *   label offsets[n+1]      (uint64) in label chars
+ *   label order[n]          (uint32) nodes sorted by label
+ *   label chars[label_bytes]
+ * Integers are stored in native byte order (checked at loading), so that
+ * arrays can be used in place from a memory mapping of the file.
+ * The version must be incremented whenever the layout changes.
+ */
+struct hierarchy_header {
+    static constexpr char magic_string[8] = {'C','H','-','H','I','E','R','\n'};
+    static constexpr std::uint32_t current_version = 2;
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t n, m_fwd, m_bwd;
+    std::uint64_t has_labels, label_bytes;
+    std::uint64_t file_size;
+};
+
+// Save the hierarchy used by [q] in file [fname] with node labels [labels]
+// (one per node, or none if [labels] is empty).
+void save_hierarchy(const std::string & fname, const ch_query & q,
+                    const label_dict & labels = label_dict()) ;
+
+// A hierarchy file mapped in memory (read-only and shared among processes).
+class hierarchy_file {
+    std::shared_ptr<const mapped_file> file;
+    hierarchy_header header;
+    ch_query engine;
+    frozen_array<std::uint64_t> label_offsets;
+    frozen_array<node> label_order;
+    frozen_array<char> label_chars;
+
+public:
+    // Map file [fname]. Sizes, offsets, node ids and ranks are checked in
+    // O(n+m), so that a truncated or corrupt file fails a CHECK instead of
+    // making queries read out of bounds.
+    explicit hierarchy_file(const std::string & fname) ;
+
+    std::size_t nb_nodes() const { return header.n; }
+
+    // A query engine whose graphs are in the mapping (nothing is copied,
+    // only search workspaces are allocated). Use one per thread.
+    ch_query query() const { return engine; }
+
+    bool has_labels() const { return header.has_labels != 0; }
+
+    std::string_view label(node u) const ;
+
+    // Node with label [lab], or an invalid node if there is none.
+    node index(std::string_view lab) const ;
+};
+
+namespace unit {
+    void test_hierarchy_file();
+}
+
+}
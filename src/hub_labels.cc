@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <thread>
+
+#include "hub_labels.hh"
+#include "parallel.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+std::uint64_t hub_labels::merge_min(const hub_t *h1,
+                                    const std::uint_least32_t *d1,
+                                    std::size_t n1,
+                                    const hub_t *h2,
+                                    const std::uint_least32_t *d2,
+                                    std::size_t n2) {
+    std::uint64_t best = std::numeric_limits<std::uint64_t>::max();
+    std::size_t i = 0, j = 0;
+    while (i < n1 && j < n2) {
+        const hub_t a = h1[i], b = h2[j];
+        if (a == b) { best = std::min(best, std::uint64_t(d1[i]) + d2[j]); }
+        i += a <= b;
+        j += b <= a;
+    }
+    return best;
+}
+
+hub_labels::hub_labels(const ch_query & q, std::size_t nb_threads)
+    : idx(q.index())
+{
+    if (nb_threads == 0) {
+        nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const ch_index & ix = *idx;
+    const std::size_t n = ix.nb_nodes();
+    const auto & rank = ix.ranks(); // by internal id
+    const static_digraph & up_fwd = ix.upward_fwd(), & up_bwd = ix.upward_bwd();
+
+    // Uncontracted nodes share the maximum rank:
+    ch_index::rank_t top = 0;
+    std::size_t nb_top = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (rank[i] > top) { top = rank[i]; nb_top = 0; }
+        if (rank[i] == top) { ++nb_top; }
+    }
+    auto in_core = [&rank, top, nb_top](node i) {
+        return nb_top > 1 && rank[i] == top;
+    };
+
+    // Levels, by decreasing rank (the core is level 0):
+    std::vector<node> sweep(n);
+    for (std::size_t i = 0; i < n; ++i) { sweep[i] = node(i); }
+    std::stable_sort(sweep.begin(), sweep.end(), [&rank](node u, node v) {
+            return rank[u] > rank[v];
+        });
+    std::vector<std::uint_least32_t> level(n, 0);
+    std::size_t nb_levels = 1;
+    for (node v : sweep) {
+        if (in_core(v)) continue;
+        std::uint_least32_t lev = 0;
+        for (auto e : up_fwd.out_neighbors(v)) {
+            lev = std::max(lev, level[e.dst] + 1);
+        }
+        for (auto e : up_bwd.out_neighbors(v)) {
+            lev = std::max(lev, level[e.dst] + 1);
+        }
+        level[v] = lev;
+        nb_levels = std::max(nb_levels, std::size_t(lev) + 1);
+    }
+    std::vector<std::size_t> level_offsets(nb_levels + 1, 0);
+    for (node v : sweep) { ++level_offsets[level[v] + 1]; }
+    for (std::size_t l = 0; l < nb_levels; ++l) {
+        level_offsets[l+1] += level_offsets[l];
+    }
+    std::vector<node> by_level(n);
+    {
+        std::vector<std::size_t> pos(level_offsets.begin(),
+                                     level_offsets.end() - 1);
+        for (node v : sweep) { by_level[pos[level[v]]++] = v; }
+    }
+
+    // Labels of each node (sorted by hub) until they are flattened:
+    struct entry {
+        hub_t hub;
+        std::uint_least32_t d;
+        bool operator<(const entry & o) const {
+            return hub < o.hub || (hub == o.hub && d < o.d);
+        }
+    };
+    using label = std::vector<entry>;
+    std::vector<label> lab_fwd(n), lab_bwd(n);
+    struct scratch {
+        traversal<static_digraph> trav;
+        std::vector<hub_t> hubs;
+        std::vector<std::uint_least32_t> dists;
+    };
+    std::vector<scratch> scratches(nb_threads);
+
+    // Label of [v] from labels [lab] of its upward neighbors in [up],
+    // pruned with labels [oth] of the other direction:
+    auto label_node = [&](node v, const static_digraph & up,
+                          std::vector<label> & lab,
+                          const std::vector<label> & oth, scratch & s) {
+        label & lv = lab[v];
+        if (in_core(v)) { // distances in the core
+            s.trav.dijkstra(up, v, [&rank, top](node w, dist) {
+                    return rank[w] == top;
+                });
+            for (node w : s.trav.settled_nodes()) {
+                lv.push_back({ hub_t(w), std::uint_least32_t(
+                                                 s.trav.distance(w)) });
+            }
+            std::sort(lv.begin(), lv.end());
+            return;
+        }
+        lv.push_back({ hub_t(v), 0 });
+        for (auto e : up.out_neighbors(v)) {
+            for (const entry & he : lab[e.dst]) {
+                lv.push_back({ he.hub, sat_add(he.d, e.len) });
+            }
+        }
+        std::sort(lv.begin(), lv.end());
+        lv.erase(std::unique(lv.begin(), lv.end(),
+                             [](const entry & a, const entry & b) {
+                                 return a.hub == b.hub;
+                             }), lv.end()); // shortest first
+        // Prune with bootstrapped queries:
+        s.hubs.clear();
+        s.dists.clear();
+        for (const entry & he : lv) {
+            s.hubs.push_back(he.hub);
+            s.dists.push_back(he.d);
+        }
+        // (h, d) is pruned if some hub of v and h gives a shorter path:
+        auto pruned = [&v, &oth, &s](const entry & he) {
+            if (he.hub == v) return false;
+            const label & lh = oth[he.hub];
+            std::size_t i = 0, j = 0;
+            while (i < s.hubs.size() && j < lh.size()) {
+                const hub_t a = s.hubs[i], b = lh[j].hub;
+                if (a == b && std::uint64_t(s.dists[i]) + lh[j].d < he.d) {
+                    return true;
+                }
+                i += a <= b;
+                j += b <= a;
+            }
+            return false;
+        };
+        lv.erase(std::remove_if(lv.begin(), lv.end(), pruned), lv.end());
+    };
+
+    for (std::size_t l = 0; l < nb_levels; ++l) {
+        const std::size_t beg = level_offsets[l], end = level_offsets[l+1];
+        auto work = [&](std::size_t i, std::size_t t) {
+            node v = by_level[beg + i];
+            label_node(v, up_fwd, lab_fwd, lab_bwd, scratches[t]);
+            label_node(v, up_bwd, lab_bwd, lab_fwd, scratches[t]);
+        };
+        if (end - beg < 64 || nb_threads == 1) {
+            for (std::size_t i = 0; i < end - beg; ++i) { work(i, 0); }
+        } else {
+            parallel_for(end - beg, nb_threads, work);
+        }
+    }
+
+    // Flatten:
+    for (auto fl : { std::make_pair(&fwd, &lab_fwd),
+                     std::make_pair(&bwd, &lab_bwd) }) {
+        flat_labels & flat = *fl.first;
+        std::vector<label> & lab = *fl.second;
+        std::size_t size = 0;
+        for (const label & lv : lab) { size += lv.size(); }
+        flat.offsets.reserve(n + 1);
+        flat.hubs.reserve(size);
+        flat.dists.reserve(size);
+        flat.offsets.push_back(0);
+        for (label & lv : lab) {
+            for (const entry & he : lv) {
+                flat.hubs.push_back(he.hub);
+                flat.dists.push_back(he.d);
+            }
+            flat.offsets.push_back(flat.hubs.size());
+            label().swap(lv);
+        }
+    }
+}
+
+dist hub_labels::distance(node src, node dst) const {
+    const node i = idx->internal(src), j = idx->internal(dst);
+    const std::size_t bi = fwd.offsets[i], bj = bwd.offsets[j];
+    std::uint64_t d = merge_min(fwd.hubs.data() + bi, fwd.dists.data() + bi,
+                                fwd.offsets[i+1] - bi,
+                                bwd.hubs.data() + bj, bwd.dists.data() + bj,
+                                bwd.offsets[j+1] - bj);
+    return dist(std::uint_least32_t(std::min(d, std::uint64_t(infinity))));
+}
+
+namespace unit {
+
+    void test_hub_labels() {
+        // Labels of the core of a partial hierarchy are quadratic, the
+        // core of dg_road is kept small:
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            for (float max_deg : {std::numeric_limits<float>::max(),
+                                  g.n() > 1000 ? 6.f : 3.f}) {
+                contraction contr(g);
+                contr.contract(max_deg); // full or partial
+                hub_labels hl(contr.query_engine());
+                CHECK(hl.nb_nodes() == g.n());
+                std::cout <<"hub labels: "<< hl.nb_entries() <<" entries\n";
+                traversal<digraph> trav;
+                const std::size_t incr = std::max(std::size_t(1), g.n() / 20);
+                for (std::size_t i = 0; i < g.n(); i += incr) {
+                    node u(i);
+                    trav.dijkstra(g, u);
+                    for (node v : g) {
+                        CHECK(hl.distance(u, v) == trav.distance(v));
+                    }
+                }
+                // Labels do not depend on the number of threads:
+                hub_labels hl1(contr.query_engine(), 1),
+                    hl3(contr.query_engine(), 3);
+                CHECK(hl1.nb_entries() == hl3.nb_entries());
+                for (node v : g) {
+                    CHECK(hl1.forward_label_size(v)
+                          == hl3.forward_label_size(v));
+                    CHECK(hl1.backward_label_size(v)
+                          == hl3.backward_label_size(v));
+                }
+            }
+        }
+    }
+
+}
+
+}
@@ -0,0 +1,91 @@
+// Hub labels computed from a contraction hierarchy.
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+#include "ch_query.hh"
+
+namespace ch {
+
+/** Each node v gets a forward label: a set of hubs h with the distance from
+ * v to h, and a backward label with distances from hubs to v, such that
+ * some hub of a shortest path from s to t appears in both the forward label
+ * of s and the backward label of t. The distance is then the minimum of
+ * d(s,h) + d(h,t) over common hubs.
+ *
+ * Labels are derived from the hierarchy top-down (by decreasing rank): the
+ * forward label of v is v itself plus the forward labels of its upward
+ * neighbors, extended by the length of the edge to them (the upward search
+ * space of v). An entry (h, d) is then pruned when a query between the new
+ * label of v and the (final) backward label of h gives a distance less than
+ * d: h is not on a shortest path from v in the hierarchy. Labels of a node
+ * only depend on labels of higher nodes, so that nodes of a same level (one
+ * plus the maximum level of their upward neighbors) are labeled in
+ * parallel.
+ *
+ * Uncontracted nodes of a partial hierarchy (the core) are all in the
+ * label of each other, with distances computed in the core: labels of the
+ * core are quadratic in its size.
+ *
+ * Labels are stored in flat arrays, hubs and distances separately, each
+ * label being sorted by hub. Hubs are internal ids of the ch_index, that is
+ * by decreasing rank, so that the top of the hierarchy comes first in all
+ * labels. A query is a merge of two sorted arrays.
+ */
+class hub_labels {
+
+public:
+    using hub_t = std::uint_least32_t;
+
+protected:
+    // Labels of internal id i are [offsets[i], offsets[i+1]) of hubs and
+    // dists:
+    struct flat_labels {
+        std::vector<std::size_t> offsets;
+        std::vector<hub_t> hubs;
+        std::vector<std::uint_least32_t> dists;
+    };
+
+    std::shared_ptr<const ch_index> idx;
+    flat_labels fwd, bwd;
+
+    // Minimum of d1[i] + d2[j] for h1[i] == h2[j], i < n1, j < n2
+    // (infinity if none). Hubs must be sorted.
+    static std::uint64_t merge_min(const hub_t *h1,
+                                   const std::uint_least32_t *d1,
+                                   std::size_t n1,
+                                   const hub_t *h2,
+                                   const std::uint_least32_t *d2,
+                                   std::size_t n2) ;
+
+public:
+
+    // Labels of the hierarchy of [q], computed with [nb_threads] threads
+    // (0 means one per hardware thread).
+    explicit hub_labels(const ch_query & q, std::size_t nb_threads = 0) ;
+
+    std::size_t nb_nodes() const { return fwd.offsets.size() - 1; }
+
+    // Total number of entries of forward and backward labels.
+    std::size_t nb_entries() const { return fwd.hubs.size() + bwd.hubs.size(); }
+
+    std::size_t forward_label_size(node u) const {
+        node i = idx->internal(u);
+        return fwd.offsets[std::size_t(i) + 1] - fwd.offsets[i];
+    }
+    std::size_t backward_label_size(node u) const {
+        node i = idx->internal(u);
+        return bwd.offsets[std::size_t(i) + 1] - bwd.offsets[i];
+    }
+
+    // Queries only read labels: they can be run concurrently.
+    dist distance(node src, node dst) const ;
+};
+
+namespace unit {
+    void test_hub_labels();
+}
+
+}
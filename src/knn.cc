@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <random>
+
+#include "knn.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+knn_index::knn_index(const ch_query & q)
+    : query(q), buckets(q.nb_nodes()), nb_entries(0) {}
+
+void knn_index::bucket::merge() {
+    auto by_dist = [](const entry & x, const entry & y) { return x.d < y.d; };
+    if (nb_removed > 0) {
+        sorted.erase(std::remove_if(sorted.begin(), sorted.end(),
+                                    [](const entry & e) {
+                                        return e.target == removed;
+                                    }), sorted.end());
+        nb_removed = 0;
+    }
+    std::sort(pending.begin(), pending.end(), by_dist);
+    const std::size_t mid = sorted.size();
+    sorted.insert(sorted.end(), pending.begin(), pending.end());
+    std::inplace_merge(sorted.begin(), sorted.begin() + mid, sorted.end(),
+                       by_dist);
+    pending.clear();
+}
+
+void knn_index::insert_entries(target_t t) {
+    query.backward_search_space(target_nodes[t], [this, t](node_dist ud) {
+            bucket & b = buckets[ud._node];
+            b.pending.push_back({ std::uint_least32_t(ud._dist), t });
+            // Pending entries are at most 1/256 of sorted ones (plus a few):
+            if (b.pending.size() > 8 + b.sorted.size() / 256) { b.merge(); }
+            ++nb_entries;
+        });
+}
+
+void knn_index::remove_entries(target_t t) {
+    // Searches are deterministic: the same entries are found again.
+    query.backward_search_space(target_nodes[t], [this, t](node_dist ud) {
+            bucket & b = buckets[ud._node];
+            const std::uint_least32_t d = ud._dist;
+            --nb_entries;
+            auto it = std::lower_bound(b.sorted.begin(), b.sorted.end(), d,
+                                       [](const entry & x,
+                                          std::uint_least32_t d) {
+                                           return x.d < d;
+                                       });
+            while (it != b.sorted.end() && it->d == d && it->target != t) {
+                ++it;
+            }
+            if (it != b.sorted.end() && it->target == t) {
+                it->target = removed;
+                // Drop removed entries when they are a quarter of them:
+                if (++b.nb_removed > b.sorted.size() / 4) { b.merge(); }
+                return;
+            }
+            for (entry & e : b.pending) { // not merged yet
+                if (e.target == t) {
+                    assert(e.d == d);
+                    e = b.pending.back();
+                    b.pending.pop_back();
+                    return;
+                }
+            }
+            assert(false); // not found
+        });
+}
+
+knn_index::target_t knn_index::add_target(node v) {
+    target_t t;
+    if (free_handles.empty()) {
+        t = target_t(target_nodes.size());
+        target_nodes.push_back(v);
+    } else {
+        t = free_handles.back();
+        free_handles.pop_back();
+        target_nodes[t] = v;
+    }
+    insert_entries(t);
+    return t;
+}
+
+void knn_index::remove_target(target_t t) {
+    assert(target_nodes[t].valid());
+    remove_entries(t);
+    target_nodes[t] = node();
+    free_handles.push_back(t);
+}
+
+void knn_index::move_target(target_t t, node v) {
+    assert(target_nodes[t].valid());
+    remove_entries(t);
+    target_nodes[t] = v;
+    insert_entries(t);
+}
+
+void knn_index::improve(target_t t, std::uint_least32_t d, std::size_t k) {
+    // Linear scans: k is expected to be small.
+    std::size_t i = 0;
+    while (i < best.size() && best[i].target != t) { ++i; }
+    if (i < best.size()) {
+        if (d >= best[i].d) return;
+    } else if (best.size() < k) {
+        best.push_back({ t, dist(d) });
+    } else if (d < best.back().d) {
+        i = best.size() - 1;
+    } else {
+        return;
+    }
+    while (i > 0 && best[i-1].d > dist(d)) { best[i] = best[i-1]; --i; }
+    best[i] = { t, dist(d) };
+}
+
+std::vector<knn_index::target_dist> knn_index::nearest(node src,
+                                                       std::size_t k) {
+    best.clear();
+    if (k == 0) { return best; }
+    auto bound = [this, k]() {
+        return best.size() < k ? dist(dist_max) : best.back().d;
+    };
+    query.forward_search_space_bounded(src, [this, k, &bound](node_dist ud) {
+            const bucket & bu = buckets[ud._node];
+            const std::uint64_t du = ud._dist;
+            std::uint64_t b = bound();
+            for (const entry & e : bu.sorted) {
+                const std::uint64_t d = du + e.d;
+                if (d >= b) break; // next entries are further
+                if (e.target == removed) continue;
+                improve(e.target, std::uint_least32_t(d), k);
+                b = bound();
+            }
+            for (const entry & e : bu.pending) {
+                const std::uint64_t d = du + e.d;
+                if (d < b) {
+                    improve(e.target, std::uint_least32_t(d), k);
+                    b = bound();
+                }
+            }
+        }, bound);
+    return best;
+}
+
+namespace unit {
+
+    void test_knn() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            for (float max_deg : {std::numeric_limits<float>::max(), 3.f}) {
+                contraction contr(g);
+                contr.contract(max_deg); // full or partial
+                knn_index knn(contr.query_engine());
+                std::mt19937 gen(123);
+                std::uniform_int_distribution<std::size_t> rnd(0, g.n() - 1);
+                std::vector<knn_index::target_t> handles;
+                for (std::size_t i = 0; i < std::min(g.n(), std::size_t(500));
+                     ++i) {
+                    handles.push_back(knn.add_target(node(rnd(gen))));
+                }
+                traversal<digraph> trav;
+                // Distances of returned targets are exact, and the k-th is
+                // the k-th smallest distance over all targets:
+                auto check = [&]() {
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        const node s(rnd(gen));
+                        trav.dijkstra(g, s);
+                        std::vector<dist> all;
+                        for (knn_index::target_t t : handles) {
+                            dist d = trav.distance(knn.target_node(t));
+                            if (d < dist_max) { all.push_back(d); }
+                        }
+                        std::sort(all.begin(), all.end());
+                        for (std::size_t k : {1, 5, 20}) {
+                            auto res = knn.nearest(s, k);
+                            CHECK(res.size() == std::min(k, all.size()));
+                            for (std::size_t j = 0; j < res.size(); ++j) {
+                                CHECK(res[j].d == all[j]);
+                                CHECK(res[j].d == trav.distance(
+                                          knn.target_node(res[j].target)));
+                            }
+                        }
+                    }
+                };
+                check();
+                const std::size_t nb_entries = knn.nb_bucket_entries();
+
+                // Remove half of the targets and move others:
+                std::vector<knn_index::target_t> kept;
+                for (std::size_t i = 0; i < handles.size(); ++i) {
+                    if (i % 2 == 0) { knn.remove_target(handles[i]); }
+                    else {
+                        if (i % 3 == 0) {
+                            knn.move_target(handles[i], node(rnd(gen)));
+                        }
+                        kept.push_back(handles[i]);
+                    }
+                }
+                handles = kept;
+                CHECK(knn.nb_targets() == handles.size());
+                CHECK(knn.nb_bucket_entries() < nb_entries);
+                check();
+
+                // Repeated moves go through pending and removed entries:
+                for (int r = 0; r < 3; ++r) {
+                    for (knn_index::target_t t : handles) {
+                        knn.move_target(t, node(rnd(gen)));
+                    }
+                }
+                check();
+
+                // Handles are reused:
+                knn_index::target_t t = knn.add_target(node(0));
+                CHECK(t < handles.size() * 2 + 1);
+                handles.push_back(t);
+                check();
+                CHECK(knn.nearest(node(0), 0).empty());
+            }
+        }
+    }
+
+}
+
+}
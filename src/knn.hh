@@ -0,0 +1,105 @@
+// k nearest targets with buckets on a contraction hierarchy.
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+#include "ch_query.hh"
+
+namespace ch {
+
+/** Index of a dynamic set of targets (e.g. vehicles) for finding the k
+ * targets closest to a source. As for ch_query::distance_table(), the
+ * backward upward search space of each target is stored in buckets: the
+ * bucket of node v holds an entry (t, d) for each target t whose backward
+ * search settled v at distance d. A query is a single forward upward search
+ * from the source, scanning the buckets of the nodes it settles.
+ *
+ * Most entries of a bucket are sorted by distance, so that the scan of a
+ * bucket stops at the first entry which cannot beat the k-th best distance
+ * found so far, and the search itself stops when its next node is that
+ * far. This matters for nodes at the top of the hierarchy whose buckets
+ * contain most targets. New entries go to a short unsorted list of pending
+ * entries (scanned entirely by queries), merged into the sorted ones when
+ * it gets longer than a small fraction of them. Removed sorted entries are
+ * only marked as such, and dropped at the next merge. Adding or removing a
+ * target thus never moves a whole bucket, except for merges whose cost is
+ * amortized over many insertions.
+ *
+ * Adding a target is one backward search and an insertion in the buckets
+ * of its search space. Removing it runs the same search again to find its
+ * entries (the hierarchy does not change, nor do the distances). Targets
+ * are designated by handles returned by add_target(), handles of removed
+ * targets are reused.
+ */
+class knn_index {
+
+public:
+    using target_t = std::uint_least32_t;
+
+    struct target_dist {
+        target_t target;
+        dist d;
+    };
+
+protected:
+    static constexpr target_t removed = std::numeric_limits<target_t>::max();
+
+    struct entry {
+        std::uint_least32_t d;
+        target_t target; // [removed] for a removed sorted entry
+    };
+    struct bucket {
+        std::vector<entry> sorted; // by distance
+        std::vector<entry> pending; // unsorted
+        std::size_t nb_removed = 0; // in sorted
+
+        // Merge pending entries into sorted ones, dropping removed ones.
+        void merge() ;
+    };
+
+    ch_query query; // for upward searches
+    std::vector<bucket> buckets; // by (external) node
+    std::vector<node> target_nodes; // invalid node() for a free handle
+    std::vector<target_t> free_handles;
+    std::size_t nb_entries;
+    std::vector<target_dist> best; // of the current query, sorted
+
+    // Add or remove the entries of target [t] (at node target_nodes[t]).
+    void insert_entries(target_t t) ;
+    void remove_entries(target_t t) ;
+    // Record distance [d] to target [t] in [best], keeping [k] targets.
+    void improve(target_t t, std::uint_least32_t d, std::size_t k) ;
+
+public:
+
+    explicit knn_index(const ch_query & q) ;
+
+    // Add a target at node [v] and return its handle.
+    target_t add_target(node v) ;
+
+    // Remove target [t] (its handle can then be returned by add_target()).
+    void remove_target(target_t t) ;
+
+    // Move target [t] to node [v] (keeping its handle).
+    void move_target(target_t t, node v) ;
+
+    node target_node(target_t t) const { return target_nodes[t]; }
+    std::size_t nb_targets() const {
+        return target_nodes.size() - free_handles.size();
+    }
+
+    // Total number of bucket entries.
+    std::size_t nb_bucket_entries() const { return nb_entries; }
+
+    // The [k] targets closest to [src] (or less if less targets can be
+    // reached from [src]), by increasing distance.
+    std::vector<target_dist> nearest(node src, std::size_t k) ;
+};
+
+namespace unit {
+    void test_knn();
+}
+
+}
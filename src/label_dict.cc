@@ -0,0 +1,162 @@
+#include "label_dict.hh"
+
+namespace ch {
+
+label_dict::label_dict()
+    : integers(true), offsets(1, 0), nb_labels(0), slots(16, 0) {}
+
+bool label_dict::parse_integer(std::string_view lab, std::uint64_t & x) {
+    if (lab.empty() || lab.size() > 20) return false;
+    if (lab.size() > 1 && lab[0] == '0') return false; // not canonical
+    const std::uint64_t max = std::numeric_limits<std::uint64_t>::max();
+    x = 0;
+    for (char c : lab) {
+        if (c < '0' || c > '9') return false;
+        const unsigned d = c - '0';
+        if (x > (max - d) / 10) return false; // overflow
+        x = 10 * x + d;
+    }
+    return true;
+}
+
+std::size_t label_dict::hash_integer(std::uint64_t x) { // splitmix64
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::size_t label_dict::hash_string(std::string_view s) { // FNV-1a
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (char c : s) { h = (h ^ std::uint8_t(c)) * 0x100000001b3ULL; }
+    return hash_integer(h); // mix low bits
+}
+
+std::size_t label_dict::slot(std::string_view lab, std::uint64_t x) const {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t s = (integers ? hash_integer(x) : hash_string(lab)) & mask;
+    while (slots[s] != 0) {
+        const std::size_t i = slots[s] - 1;
+        if (integers ? ids[i] == x : pooled(i) == lab) break;
+        s = (s + 1) & mask;
+    }
+    return s;
+}
+
+void label_dict::insert_slot(std::size_t i) {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t s = hash(i) & mask;
+    while (slots[s] != 0) { s = (s + 1) & mask; }
+    slots[s] = std::uint_least32_t(i + 1);
+}
+
+void label_dict::rehash(std::size_t nb_slots) {
+    slots.assign(nb_slots, 0);
+    for (std::size_t i = 0; i < nb_labels; ++i) { insert_slot(i); }
+}
+
+void label_dict::to_string_mode() {
+    for (std::uint64_t x : ids) {
+        const std::string lab = std::to_string(x);
+        pool.insert(pool.end(), lab.begin(), lab.end());
+        offsets.push_back(pool.size());
+    }
+    std::vector<std::uint64_t>().swap(ids);
+    integers = false;
+    rehash(slots.size());
+}
+
+node label_dict::add(std::string_view lab) {
+    std::uint64_t x = 0;
+    if (integers && ! parse_integer(lab, x)) { to_string_mode(); }
+    const std::size_t s = slot(lab, x);
+    if (slots[s] != 0) { return node(slots[s] - 1); }
+    const std::size_t i = nb_labels++;
+    CHECK(i + 1 < std::numeric_limits<std::uint_least32_t>::max());
+    if (integers) {
+        ids.push_back(x);
+    } else {
+        pool.insert(pool.end(), lab.begin(), lab.end());
+        offsets.push_back(pool.size());
+    }
+    slots[s] = std::uint_least32_t(i + 1);
+    if (2 * nb_labels > slots.size()) { rehash(2 * slots.size()); }
+    return node(i);
+}
+
+node label_dict::find(std::string_view lab) const {
+    std::uint64_t x = 0;
+    if (integers && ! parse_integer(lab, x)) { return node(); }
+    const std::size_t s = slot(lab, x);
+    return slots[s] == 0 ? node() : node(slots[s] - 1);
+}
+
+std::string label_dict::label(node i) const {
+    assert(i < nb_labels);
+    return integers ? std::to_string(ids[i]) : std::string(pooled(i));
+}
+
+void label_dict::reserve(std::size_t n) {
+    if (integers) { ids.reserve(n); }
+    else { offsets.reserve(n + 1); }
+    std::size_t nb_slots = slots.size();
+    while (nb_slots < 2 * n) { nb_slots *= 2; }
+    if (nb_slots > slots.size()) { rehash(nb_slots); }
+}
+
+std::size_t label_dict::memory_bytes() const {
+    return sizeof(*this)
+        + ids.capacity() * sizeof(std::uint64_t)
+        + pool.capacity()
+        + offsets.capacity() * sizeof(std::uint64_t)
+        + slots.capacity() * sizeof(std::uint_least32_t);
+}
+
+bool label_dict::operator==(const label_dict & o) const {
+    if (nb_labels != o.nb_labels) return false;
+    if (integers && o.integers) return ids == o.ids;
+    for (std::size_t i = 0; i < nb_labels; ++i) {
+        if (label(node(i)) != o.label(node(i))) return false;
+    }
+    return true;
+}
+
+namespace unit {
+
+    void test_label_dict() {
+        label_dict d;
+        CHECK(d.add("42") == node(0) && d.add("7") == node(1));
+        CHECK(d.add("42") == node(0));
+        CHECK(d.add("18446744073709551615") == node(2)); // 2^64 - 1
+        CHECK(d.integer_mode() && d.size() == 3);
+        CHECK(d.find("7") == node(1) && ! d.find("8").valid());
+        CHECK( ! d.find("07").valid() && ! d.find("x").valid());
+        CHECK(d.label(node(2)) == "18446744073709551615");
+
+        // Many labels (rehashing), then a non integer one:
+        for (std::size_t i = 0; i < 1000; ++i) {
+            CHECK(d.add(std::to_string(1000 * i + 3)) == node(3 + i));
+        }
+        CHECK(d.add("07") == node(1003)); // leading zero: a string
+        CHECK( ! d.integer_mode());
+        CHECK(d.add("18446744073709551616") == node(1004)); // 2^64
+        for (std::size_t i = 0; i < 1000; ++i) {
+            CHECK(d.find(std::to_string(1000 * i + 3)) == node(3 + i));
+            CHECK(d.label(node(3 + i)) == std::to_string(1000 * i + 3));
+        }
+        CHECK(d.find("7") == node(1) && d.find("07") == node(1003));
+        CHECK(d.add("") == node(1005) && d.find("") == node(1005));
+        CHECK(d.label(node(1003)) == "07" && d.size() == 1006);
+
+        // Equality compares labels in order:
+        label_dict e, f;
+        for (std::string lab : {"1", "2", "3"}) { e.add(lab); f.add(lab); }
+        f.add("a");
+        CHECK( ! (e == f));
+        e.add("a");
+        CHECK(e == f);
+        CHECK(d.memory_bytes() > 0);
+    }
+
+}
+
+}
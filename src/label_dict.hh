@@ -0,0 +1,83 @@
+// Compact dictionary of node labels.
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "basics.hh"
+
+namespace ch {
+
+/** Labels are indexed 0, 1, 2... in order of insertion. As long as all
+ * labels are integers in decimal notation (without leading zeros) that fit
+ * in 64 bits, as node ids of OpenStreetMap, they are stored as integers
+ * (integer mode). The first other label converts the dictionary to string
+ * mode, where labels are stored one after the other in a single buffer.
+ * In both modes, labels are found through an open addressing hash table
+ * (linear probing) of label indexes.
+ */
+class label_dict {
+
+protected:
+    bool integers; // integer mode
+    std::vector<std::uint64_t> ids; // integer mode
+    std::vector<char> pool; // string mode: label i is
+    std::vector<std::uint64_t> offsets; // pool[offsets[i]..offsets[i+1])
+    std::size_t nb_labels;
+    // Index + 1 of the label in each slot (0 for an empty slot), the number
+    // of slots is a power of 2:
+    std::vector<std::uint_least32_t> slots;
+
+    std::string_view pooled(std::size_t i) const {
+        return std::string_view(pool.data() + offsets[i],
+                                offsets[i+1] - offsets[i]);
+    }
+    std::size_t hash(std::size_t i) const {
+        return integers ? hash_integer(ids[i]) : hash_string(pooled(i));
+    }
+    // Slot of [lab] (with integer value [x] in integer mode) or of the
+    // empty slot where it would be inserted.
+    std::size_t slot(std::string_view lab, std::uint64_t x) const ;
+    void insert_slot(std::size_t i) ; // index [i] in a free slot
+    void rehash(std::size_t nb_slots) ;
+    void to_string_mode() ;
+
+public:
+
+    label_dict() ;
+
+    // Returns [true] and sets [x] if [lab] is an integer in canonical
+    // decimal notation.
+    static bool parse_integer(std::string_view lab, std::uint64_t & x) ;
+    static std::size_t hash_integer(std::uint64_t x) ;
+    static std::size_t hash_string(std::string_view s) ;
+
+    std::size_t size() const { return nb_labels; }
+    bool integer_mode() const { return integers; }
+
+    // Add a label if not present, and return its index.
+    node add(std::string_view lab) ;
+
+    // Index of label [lab], invalid node() if absent.
+    node find(std::string_view lab) const ;
+
+    std::string label(node i) const ;
+    std::string operator[](node i) const { return label(i); }
+
+    // Prepare for [n] labels.
+    void reserve(std::size_t n) ;
+
+    // Memory held by the dictionary (allocated capacity).
+    std::size_t memory_bytes() const ;
+
+    // Same labels in the same order (whatever the mode).
+    bool operator==(const label_dict & o) const ;
+};
+
+namespace unit {
+    void test_label_dict();
+}
+
+}
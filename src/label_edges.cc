@@ -1,28 +1,18 @@
 #include <sstream>
+#include <cstring>
+#include <string_view>
+#include <thread>
 
 #include "label_edges.hh"
+#include "mapped_file.hh"
+#include "digraph_builder.hh"
+#include "parallel.hh"
 
 namespace ch {
 
-node label_edges::add_label(const std::string & lab) {
-    if (indexes.count(lab) == 0) {
-        node i = node(labels.size());
-        labels.push_back(lab);
-        indexes[lab] = i;
-        return i;
-    } else {
-        return indexes[lab];
-    }
-}
-
 label_edges::label_edges(std::string fname) {
     if (fname == "-") { parse_istream(std::cin); }
-    else {
-        std::ifstream file(fname);
-        CHECK(file.is_open());
-        parse_istream(file);
-        file.close();
-    }
+    else { parse_file(fname); }
 }
     
 void label_edges::parse_istream(std::istream & is) {
@@ -54,6 +44,349 @@ void label_edges::parse_istream(std::istream & is) {
 }
 
 
+// ----------------- parallel parsing of a memory-mapped file
+
+namespace {
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+std::uint64_t parse_length(std::string_view s) {
+    const std::uint64_t length_max = std::numeric_limits<edge_len>::max();
+    CHECK( ! s.empty());
+    std::uint64_t x = 0;
+    for (char c : s) {
+        CHECK(c >= '0' && c <= '9');
+        x = 10 * x + (c - '0');
+        CHECK(x <= length_max);
+    }
+    return x;
+}
+
+// Open addressing hash table (linear probing) of labels viewed in a mapped
+// file, each with a 64 bits key. As in label_dict, labels are first
+// integers (integer mode) whose key is their value, parsed once; the first
+// other label converts the table to string mode where keys are hashes.
+struct label_table {
+    bool integers = true;
+    std::vector<std::string_view> labels;
+    std::vector<std::uint64_t> keys;
+    std::vector<std::uint_least32_t> slots; // index + 1 (0 for empty)
+
+    label_table() : slots(16, 0) {}
+
+    std::size_t size() const { return labels.size(); }
+
+    static std::size_t hash(std::uint64_t key, bool integers) {
+        return integers ? label_dict::hash_integer(key) : key;
+    }
+    std::size_t hash(std::uint64_t key) const { return hash(key, integers); }
+
+    // Index of label [lab] with key [key], added last if absent.
+    std::size_t add(std::string_view lab, std::uint64_t key) {
+        const std::size_t mask = slots.size() - 1;
+        std::size_t s = hash(key) & mask;
+        while (slots[s] != 0) {
+            const std::size_t i = slots[s] - 1;
+            if (keys[i] == key && (integers || labels[i] == lab)) return i;
+            s = (s + 1) & mask;
+        }
+        const std::size_t i = labels.size();
+        CHECK(i + 1 < std::numeric_limits<std::uint_least32_t>::max());
+        labels.push_back(lab);
+        keys.push_back(key);
+        slots[s] = std::uint_least32_t(i + 1);
+        if (2 * labels.size() > slots.size()) { rehash(2 * slots.size()); }
+        return i;
+    }
+
+    // Index of label [lab], added last if absent.
+    std::size_t add(std::string_view lab) {
+        std::uint64_t x = 0;
+        if (integers && ! label_dict::parse_integer(lab, x)) {
+            to_string_mode();
+        }
+        return add(lab, integers ? x : label_dict::hash_string(lab));
+    }
+
+    void rehash(std::size_t nb_slots) {
+        slots.assign(nb_slots, 0);
+        const std::size_t mask = nb_slots - 1;
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            std::size_t s = hash(keys[i]) & mask;
+            while (slots[s] != 0) { s = (s + 1) & mask; }
+            slots[s] = std::uint_least32_t(i + 1);
+        }
+    }
+
+    void to_string_mode() {
+        if ( ! integers) return;
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            keys[i] = label_dict::hash_string(labels[i]);
+        }
+        integers = false;
+        rehash(slots.size());
+    }
+};
+
+// Edges of a chunk of lines with labels indexed locally to the chunk.
+struct chunk_edges {
+    label_table labels;
+    std::vector<edge> edges;
+
+    node add_label(std::string_view lab) { return node(labels.add(lab)); }
+
+    void parse(const char *p, const char *end) {
+        while (p < end) {
+            while (p < end && (is_blank(*p) || *p == '\n')) { ++p; }
+            if (p == end) break;
+            const char *eol = static_cast<const char *>
+                (std::memchr(p, '\n', end - p));
+            if (eol == nullptr) { eol = end; }
+            if (*p == '#') { p = eol; continue; }
+            std::string_view tok[3];
+            int ntok = 0;
+            while (true) {
+                while (p < eol && is_blank(*p)) { ++p; }
+                if (p == eol) break;
+                const char *beg = p;
+                while (p < eol && ! is_blank(*p)) { ++p; }
+                CHECK(ntok < 3);
+                tok[ntok++] = std::string_view(beg, p - beg);
+            }
+            CHECK(ntok >= 2);
+            std::uint64_t len = ntok == 3 ? parse_length(tok[2]) : 1;
+            node src = add_label(tok[0]);
+            node dst = add_label(tok[1]);
+            edges.push_back({src, dst, edge_len(len)});
+        }
+    }
+};
+
+// Labels of all chunks are partitioned by key among several threads, each
+// merging its partition of every chunk in chunk order.
+struct label_partition {
+    label_table table;
+    std::vector<std::uint64_t> first; // chunk << 32 | local index
+    std::vector<node> index; // in [labels], invalid while unknown
+};
+
+}
+
+/* Merge the labels of [chunks] into [labels] with [nb_threads] threads: new
+ * labels are indexed in order of first appearance (chunk after chunk), and
+ * global[c][i] is set to the index of local label i of chunk c. Each label
+ * of the chunks is looked up once in the table of its partition, [labels]
+ * then receives only new labels.
+ */
+static void merge_labels(std::size_t nb_threads,
+                         std::vector<chunk_edges> & chunks, label_dict & labels,
+                         std::vector<std::vector<node>> & global) {
+    const std::size_t nchunks = chunks.size();
+    std::size_t np = 1;
+    while (np < 4 * nb_threads) { np *= 2; }
+
+    // Keys are comparable across chunks when all are in the same mode:
+    bool integers = true;
+    for (const chunk_edges & ch : chunks) { integers &= ch.labels.integers; }
+    if ( ! integers) {
+        parallel_for(nchunks, nb_threads, [&chunks](std::size_t c,
+                                                    std::size_t) {
+                chunks[c].labels.to_string_mode();
+            });
+    }
+    auto part = [np, integers](std::uint64_t key) {
+        return (label_table::hash(key, integers) >> 40) & (np - 1);
+    }; // slots use low bits
+
+    // Local labels of each chunk by partition:
+    std::vector<std::vector<node>> by_part(nchunks);
+    std::vector<std::vector<std::size_t>> part_beg(nchunks);
+    parallel_for(nchunks, nb_threads, [np, &chunks, &by_part, &part_beg,
+                                       &part](std::size_t c, std::size_t) {
+            const label_table & tab = chunks[c].labels;
+            std::vector<std::size_t> & beg = part_beg[c];
+            beg.assign(np + 1, 0);
+            for (std::uint64_t key : tab.keys) { ++beg[part(key) + 1]; }
+            for (std::size_t p = 0; p < np; ++p) { beg[p+1] += beg[p]; }
+            std::vector<std::size_t> pos(beg.begin(), beg.end() - 1);
+            by_part[c].resize(tab.size());
+            for (std::size_t i = 0; i < tab.size(); ++i) {
+                by_part[c][pos[part(tab.keys[i])]++] = node(i);
+            }
+        });
+
+    // Merge each partition (global[c][i] is first the index of the label in
+    // its partition):
+    global = std::vector<std::vector<node>>(nchunks);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        global[c].resize(chunks[c].labels.size());
+    }
+    std::vector<label_partition> parts(np);
+    for (label_partition & lp : parts) { lp.table.integers = integers; }
+    parallel_for(np, nb_threads, [nchunks, &chunks, &labels, &global,
+                                  &by_part, &part_beg,
+                                  &parts](std::size_t p, std::size_t) {
+            label_partition & lp = parts[p];
+            for (std::size_t c = 0; c < nchunks; ++c) {
+                const label_table & tab = chunks[c].labels;
+                for (std::size_t k = part_beg[c][p];
+                     k < part_beg[c][p+1]; ++k) {
+                    const node i = by_part[c][k];
+                    const std::size_t j = lp.table.add(tab.labels[i],
+                                                       tab.keys[i]);
+                    if (j == lp.first.size()) {
+                        lp.first.push_back(std::uint64_t(c) << 32 | i);
+                        lp.index.push_back(labels.find(tab.labels[i]));
+                    }
+                    global[c][i] = node(j);
+                }
+            }
+        });
+    by_part.clear();
+    part_beg.clear();
+
+    // New labels are numbered chunk after chunk:
+    auto is_new = [&chunks, &global, &parts, &part](std::size_t c,
+                                                    std::size_t i) {
+        const label_partition & lp = parts[part(chunks[c].labels.keys[i])];
+        const std::size_t j = global[c][i];
+        return lp.first[j] == (std::uint64_t(c) << 32 | i)
+            && ! lp.index[j].valid();
+    };
+    std::vector<std::size_t> offset(nchunks + 1, labels.size());
+    parallel_for(nchunks, nb_threads, [&chunks, &offset,
+                                       &is_new](std::size_t c, std::size_t) {
+            std::size_t nb_new = 0;
+            for (std::size_t i = 0; i < chunks[c].labels.size(); ++i) {
+                if (is_new(c, i)) { ++nb_new; }
+            }
+            offset[c+1] = nb_new;
+        });
+    for (std::size_t c = 0; c < nchunks; ++c) { offset[c+1] += offset[c]; }
+    parallel_for(nchunks, nb_threads, [&chunks, &global, &parts, &offset,
+                                       &is_new, &part](std::size_t c,
+                                                       std::size_t) {
+            std::size_t k = offset[c];
+            for (std::size_t i = 0; i < chunks[c].labels.size(); ++i) {
+                if (is_new(c, i)) {
+                    parts[part(chunks[c].labels.keys[i])]
+                        .index[global[c][i]] = node(k++);
+                }
+            }
+        });
+    parallel_for(nchunks, nb_threads, [&chunks, &global, &parts,
+                                       &part](std::size_t c, std::size_t) {
+            const label_table & tab = chunks[c].labels;
+            for (std::size_t i = 0; i < tab.size(); ++i) {
+                global[c][i] = parts[part(tab.keys[i])].index[global[c][i]];
+            }
+        });
+    parts.clear();
+
+    // Add new labels, which come in index order:
+    labels.reserve(offset[nchunks]);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        const label_table & tab = chunks[c].labels;
+        for (std::size_t i = 0; i < tab.size(); ++i) {
+            if (global[c][i] == labels.size()) { labels.add(tab.labels[i]); }
+        }
+        chunks[c].labels = label_table();
+    }
+}
+
+// Parse file [fname] by chunks with [nb_threads] threads. Labels are added
+// to [labels] in order of first appearance, chunk c then has its edges in
+// [chunks[c].edges] with local label i being global[c][i].
+static void parse_chunks(const std::string & fname, std::size_t nb_threads,
+                         label_dict & labels, std::vector<chunk_edges> & chunks,
+                         std::vector<std::vector<node>> & global) {
+    mapped_file file(fname);
+    const char *data = file.data(), *end = data + file.size();
+
+    // Split in chunks of whole lines:
+    const std::size_t nchunks = file.size() < (1 << 16) ? 1 : 4 * nb_threads;
+    std::vector<const char *> bounds(1, data);
+    for (std::size_t i = 1; i < nchunks; ++i) {
+        const char *p = std::max(bounds.back(), data + i * file.size() / nchunks);
+        while (p < end && p[-1] != '\n') { ++p; }
+        bounds.push_back(p);
+    }
+    bounds.push_back(end);
+
+    // Parse chunks in parallel:
+    chunks = std::vector<chunk_edges>(nchunks);
+    parallel_for(nchunks, nb_threads, [&chunks, &bounds](std::size_t c,
+                                                         std::size_t) {
+            chunks[c].parse(bounds[c], bounds[c+1]);
+        });
+
+    // Labels are views of the file, which is then unmapped:
+    merge_labels(nb_threads, chunks, labels, global);
+}
+
+void label_edges::parse_file(const std::string & fname,
+                             std::size_t nb_threads) {
+    if (nb_threads == 0) {
+        nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<chunk_edges> chunks;
+    std::vector<std::vector<node>> global;
+    parse_chunks(fname, nb_threads, labels, chunks, global);
+    const std::size_t nchunks = chunks.size();
+
+    // Translate edges:
+    std::vector<std::size_t> offset(nchunks + 1, edges.size());
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        offset[c+1] = offset[c] + chunks[c].edges.size();
+    }
+    edges.resize(offset[nchunks], edge(node(0), node(0)));
+    parallel_for(nchunks, nb_threads, [this, &chunks, &global,
+                                       &offset](std::size_t c, std::size_t) {
+            std::size_t i = offset[c];
+            for (const edge & e : chunks[c].edges) {
+                edges[i++] = edge(global[c][e.src], global[c][e.dst], e.len);
+            }
+            chunks[c].edges = std::vector<edge>(); // free memory
+        });
+}
+
+digraph label_edges::read_graph(const std::string & fname,
+                                std::size_t nb_threads, bool merge_parallel) {
+    if (nb_threads == 0) {
+        nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::vector<edge>> batches(1);
+    if (fname == "-") {
+        parse_istream(std::cin);
+        batches[0].swap(edges);
+    } else {
+        std::vector<chunk_edges> chunks;
+        std::vector<std::vector<node>> global;
+        parse_chunks(fname, nb_threads, labels, chunks, global);
+        batches.resize(chunks.size());
+        parallel_for(chunks.size(), nb_threads, [&chunks, &global,
+                                                 &batches](std::size_t c,
+                                                           std::size_t) {
+                const std::vector<node> & glob = global[c];
+                for (edge & e : chunks[c].edges) {
+                    e = edge(glob[e.src], glob[e.dst], e.len);
+                }
+                batches[c].swap(chunks[c].edges);
+                std::vector<node>().swap(global[c]); // free memory
+            });
+    }
+    return digraph_builder(labels.size(), nb_threads)
+        .build(batches, merge_parallel);
+}
+
+
+std::size_t label_edges::memory_bytes() const {
+    return sizeof(*this) + labels.memory_bytes() - sizeof(labels)
+        + edges.capacity() * sizeof(edge);
+}
+
 namespace unit {
 
     digraph dg_small_labs, dg_road;
@@ -64,7 +397,7 @@ namespace unit {
         for (node i : irange<node>(node(0), node(7))) {
             edg.index(std::to_string(i));
         }
-        CHECK(edg.indexes.count("not a label") == 0);
+        CHECK( ! edg.has_index("not a label"));
         
         CHECK(edg.labels.size() == 11);
         CHECK(edg.edges.size() == 17);
@@ -81,6 +414,50 @@ namespace unit {
                   << g.nb_edges() <<" edges.\n";
         CHECK(g.out_degree(edges_road.index("2272544925")) == 4);
         CHECK(g.out_degree(edges_road.index("59862146")) == 2);
+
+        // Graphs built while parsing:
+        for (std::size_t nt : {1, 3}) {
+            label_edges lab_multi, lab_merged;
+            digraph multi = lab_multi.read_graph("test_data/road_corsica.txt",
+                                                 nt, false);
+            CHECK(multi == dg_road && lab_multi.edges.empty());
+            CHECK(lab_multi.labels == edges_road.labels);
+            digraph merged = lab_merged.read_graph("test_data/road_corsica.txt",
+                                                   nt);
+            digraph h = dg_road;
+            std::cout << h.merge_parallel_edges() <<" parallel edges\n";
+            CHECK(merged == h);
+            for (node u : h) {
+                for (auto e : dg_road.out_neighbors(u)) {
+                    bool found = false;
+                    for (auto f : h.out_neighbors(u)) {
+                        if (f.dst == e.dst) { found = true; CHECK(f.len <= e.len); }
+                    }
+                    CHECK(found);
+                }
+            }
+        }
+
+        // Parallel parsing gives the same result as sequential parsing,
+        // also with labels already present:
+        for (std::string fname : {"test_data/small.txt",
+                                  "test_data/road_corsica.txt"})
+        for (bool pre : {false, true}) {
+            label_edges seq;
+            if (pre) { seq.add_label("59862146"); seq.add_label("3"); }
+            std::ifstream file(fname);
+            seq.parse_istream(file);
+            for (std::size_t nt : {1, 3, 8}) {
+                label_edges par;
+                if (pre) { par.add_label("59862146"); par.add_label("3"); }
+                par.parse_file(fname, nt);
+                CHECK(par.labels == seq.labels);
+                CHECK(par.edges.size() == seq.edges.size());
+                for (std::size_t i = 0; i < seq.edges.size(); ++i) {
+                    CHECK(par.edges[i] == seq.edges[i]);
+                }
+            }
+        }
     }
 
 }
@@ -1,49 +1,68 @@
 #pragma once
 
-#include <unordered_map>
 #include <vector>
 #include <fstream>
 
 #include "basics.hh"
 #include "ranges.hh"
 #include "digraph.hh"
+#include "label_dict.hh"
 
 namespace ch {
 
 // Edges of a graphs with arbitrary labels that are mapped to indexes.
 struct label_edges {
 
-    std::vector<std::string> labels;
-    std::unordered_map<std::string, node> indexes;
+    label_dict labels;
     std::vector<edge> edges;
 
     // Add a label if not present, and return its index.
-    node add_label(const std::string & lab) ;
+    node add_label(std::string_view lab) { return labels.add(lab); }
 
     // Get the index of label [lab]. It asserts the label is present.
-    node index(const std::string & lab) {
-        assert(indexes.count(lab) == 1);
-        return indexes[lab];
+    node index(std::string_view lab) const {
+        node i = labels.find(lab);
+        assert(i.valid());
+        return i;
     }
 
-    bool has_index(const std::string & lab) {
-        return indexes.count(lab) != 0;
+    bool has_index(std::string_view lab) const {
+        return labels.find(lab).valid();
     }
 
-    std::string label(node i) {
+    std::string label(node i) const {
         assert(i < labels.size());
-        return labels[i];
+        return labels.label(i);
     }
 
     /** Read edges from a file, or std::cin if fname is "-".
-     *  Each line should be a triple [src dst edge_len].
-     *  Lines beginning with '#' are ignored.
+     *  Each line should be a triple [src dst edge_len] ([edge_len] defaults
+     *  to 1). Lines beginning with '#' are ignored.
      */
     label_edges(std::string fname) ;
 
     label_edges() {}
     
     void parse_istream(std::istream & is) ;
+
+    // Memory held by labels and edges.
+    std::size_t memory_bytes() const ;
+
+    /** Same as parse_istream() for file [fname], which is memory-mapped and
+     *  split into chunks of lines parsed by [nb_threads] threads (0 means
+     *  one per hardware thread). Labels get the same indexes as with
+     *  parse_istream() (order of first appearance).
+     */
+    void parse_file(const std::string & fname, std::size_t nb_threads = 0) ;
+
+    /** Returns the graph of the edges of file [fname] (or std::cin if
+     *  fname is "-"), built from the parsed chunks of the file with a
+     *  digraph_builder: [edges] remains empty. Parallel edges are merged
+     *  (keeping the minimum length) when [merge_parallel] is [true].
+     *  Labels are indexed as with label_edges(fname).
+     */
+    digraph read_graph(const std::string & fname, std::size_t nb_threads = 0,
+                       bool merge_parallel = true) ;
 };
 
 namespace unit {
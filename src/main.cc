@@ -6,6 +6,7 @@
 #include "label_edges.hh"
 #include "digraph.hh"
 #include "contraction.hh"
+#include "hierarchy_file.hh"
 
 using namespace ch;
 
@@ -22,7 +23,7 @@ void usage_exit (char **argv) {
         return acc;
     };
     
-    std::cerr <<"\nUsage: "<< argv[0] <<" [-hierarchies] [graph] [subset] [max_deg]\n"
+    std::cerr <<"\nUsage: "<< argv[0] <<" [-hierarchies] [-lazy] [-save file] [graph] [subset] [max_deg]\n"
               << paragraph (
         "\nContracts nodes of the graph in file [graph] until average degree "
         "reaches [max_deg]. Nodes from [subset] are never contracted. "
@@ -31,11 +32,18 @@ void usage_exit (char **argv) {
         "distances in the graph are preserved." )
               << paragraph (
         "\nInput format for [graph]: one edge per line with format: "
-        "[src] [dst] [length]" )
+        "[src] [dst] [length]. Among parallel edges, only one with minimum "
+        "length is kept." )
               <<"Input format for [subset]: one node per line."
               << paragraph(
                            "\nOutputs a distance preserver for nodes in [subset] (i.e. a graph with node set containing [subset] with same distances as in the original graph, and with average degree at most [max_deg]). If option [-hierarchies] is given then it instead outputs the contraction hierarchies (i.e. a graph with same node set and same distances where any pair of nodes are linked by a few hops shortest path), the contraction order is given as a comment line."
                            )
+              << paragraph(
+                           "\nWith option [-lazy], nodes are ordered with a priority queue on their simulated edge difference (slower contraction, faster queries) instead of by rounds of independent sets."
+                           )
+              << paragraph(
+                           "\nIf option [-save file] is given, the contraction hierarchies are also saved in binary format (with node labels) in [file], which can be memory-mapped for queries (see hierarchy_file.hh)."
+                           )
         ;
         exit(1);
 }
@@ -61,8 +69,22 @@ int main (int argc, char **argv) {
         return false;
     };
 
+    auto del_arg_value = [&argc,&argv,i_arg](std::string a) {
+        int i = i_arg(a);
+        std::string val;
+        if (i >= 0 && i+1 < argc) {
+            val = argv[i+1];
+            for (int j = i+2; j < argc; ++j)
+                argv[j-2] = argv[j];
+            argc -= 2;
+        }
+        return val;
+    };
+
     bool do_graph = del_arg("-graph");
     bool do_hierarchies = del_arg("-hierarchies");
+    bool do_lazy = del_arg("-lazy");
+    std::string fsave = del_arg_value("-save");
     
     // ------------------------ usage -------------------------
     if (argc != 4) {
@@ -73,14 +95,15 @@ int main (int argc, char **argv) {
     float max_deg = std::stof(argv[3]);
 
     // ------------------------- load graph ----------------------
-    label_edges labedg(fgraph);
-    digraph g;
-    for (auto e : labedg.edges) { g.add(e); }
+    label_edges labedg;
+    digraph g = labedg.read_graph(fgraph);
     std::cerr <<"loaded graph with n=" << g.n() << " nodes"
               <<" and m=" << g.m() <<" edges\n";
     dist maxlen = 0;
-    for (auto e : labedg.edges) {
-        if (e.len > maxlen) { maxlen = e.len; }
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) {
+            if (e.len > maxlen) { maxlen = e.len; }
+        }
     }
     std::cerr <<"maximum edge length: "<< maxlen
               <<" (distance overflow at "<< dist_max <<")\n";
@@ -100,11 +123,16 @@ int main (int argc, char **argv) {
     std::cerr << "loaded subset of "<< subset.size() <<" nodes\n";
     
     // ------------------------- contraction -----------------------
-    contraction  ch(g, subset);
+    contraction  ch(std::move(g), subset); // g is not used anymore
+    if (do_lazy) { ch.set_ordering(contraction::ordering::lazy_priority); }
     digraph g_ch = ch.contract(max_deg);
     std::cerr << "contraction\n";
 
     // ----------------------------- output ------------------------
+    if (fsave != "") {
+        save_hierarchy(fsave, ch.query_engine(), labedg.labels);
+        std::cerr << "saved hierarchy in "<< fsave <<"\n";
+    }
     if (do_hierarchies) {
         std::vector<node> contr_order(ch.contraction_order());
         std::cout <<"# contraction_order:";
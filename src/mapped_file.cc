@@ -0,0 +1,32 @@
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "basics.hh"
+#include "mapped_file.hh"
+
+namespace ch {
+
+mapped_file::mapped_file(const std::string & fname)
+    : _data(nullptr), _size(0) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) { std::cerr <<"cannot open "<< fname <<"\n"; }
+    CHECK(fd >= 0);
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0);
+    _size = st.st_size;
+    if (_size > 0) {
+        void *p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        CHECK(p != MAP_FAILED);
+        _data = static_cast<const char *>(p);
+    }
+    close(fd); // the mapping remains valid
+}
+
+mapped_file::~mapped_file() {
+    if (_data != nullptr) { munmap(const_cast<char *>(_data), _size); }
+}
+
+}
@@ -0,0 +1,25 @@
+// Read-only memory mapping of a whole file. Pages are shared with other
+// processes mapping the same file.
+
+#pragma once
+
+#include <string>
+
+namespace ch {
+
+class mapped_file {
+    const char *_data;
+    std::size_t _size;
+
+public:
+    explicit mapped_file(const std::string & fname) ;
+    ~mapped_file() ;
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+
+    const char *data() const { return _data; }
+    std::size_t size() const { return _size; }
+};
+
+}
@@ -0,0 +1,40 @@
+// Helpers for parallel loops and for distances stored as plain integers.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "basics.hh"
+
+namespace ch {
+
+// Flat arrays of distances (phast, cch, hub_labels...) store plain
+// integers, dist_max standing for infinity.
+constexpr std::uint_least32_t infinity = dist_max;
+
+// Saturated a + l (infinity if it overflows) is min(a, infinity - l) + l.
+inline std::uint_least32_t sat_add(std::uint_least32_t a,
+                                   std::uint_least32_t l) {
+    return std::min(a, infinity - l) + l;
+}
+
+// Call [f(i, t)] for i = 0..count-1 with [nb_threads] threads, t being the
+// number of the thread (the calling thread is thread 0). Indexes are
+// handed out one at a time, so that uneven tasks are balanced.
+template <typename F> // callable as void(std::size_t, std::size_t)
+void parallel_for(std::size_t count, std::size_t nb_threads, F f) {
+    std::atomic<std::size_t> next(0);
+    auto work = [count, &f, &next](std::size_t t) {
+        for (std::size_t i; (i = next++) < count; ) { f(i, t); }
+    };
+    const std::size_t nt = std::min(nb_threads, count);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 1; t < nt; ++t) { threads.emplace_back(work, t); }
+    work(0);
+    for (auto & th : threads) { th.join(); }
+}
+
+}
@@ -0,0 +1,270 @@
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "phast.hh"
+#include "parallel.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+phast::phast(const ch_query & q)
+    : query(q), order(q.nb_nodes()), position(q.nb_nodes())
+{
+    const std::size_t n = nb_nodes();
+    const ch_index & ix = *q.index();
+    const auto & rank = ix.ranks(); // by internal id
+    // Internal ids by decreasing rank (the order of internal ids of a
+    // renumbered index):
+    std::vector<node> sweep(n);
+    for (std::size_t i = 0; i < n; ++i) { sweep[i] = node(i); }
+    std::stable_sort(sweep.begin(), sweep.end(), [&rank](node u, node v) {
+            return rank[u] > rank[v];
+        });
+    std::vector<pos_t> internal_position(n);
+    for (std::size_t p = 0; p < n; ++p) {
+        internal_position[sweep[p]] = pos_t(p);
+        order[p] = ix.external(sweep[p]);
+        position[order[p]] = pos_t(p);
+    }
+
+    // up_bwd[v] contains edges u->v with rank[u] >= rank[v], downward edges
+    // are those with rank[u] > rank[v]:
+    const static_digraph & up_bwd = ix.upward_bwd();
+    in_offsets.reserve(n + 1);
+    in_offsets.push_back(0);
+    for (node v : sweep) {
+        for (auto e : up_bwd.out_neighbors(v)) {
+            if (rank[e.dst] > rank[v]) {
+                in_edges.push_back({ internal_position[e.dst], e.len });
+            }
+        }
+        in_offsets.push_back(in_edges.size());
+    }
+}
+
+void phast::sweep() {
+    std::uint_least32_t *d = dists.data();
+    const in_edge *edg = in_edges.data();
+    const std::size_t n = nb_nodes();
+    for (std::size_t p = 0; p < n; ++p) {
+        std::uint_least32_t dp = d[p];
+        for (std::size_t i = in_offsets[p]; i < in_offsets[p+1]; ++i) {
+            dp = std::min(dp, sat_add(d[edg[i].tail], edg[i].len));
+        }
+        d[p] = dp;
+    }
+}
+
+void phast::sweep_batch() {
+    std::uint_least32_t *d = batch_dists.data();
+    const in_edge *edg = in_edges.data();
+    const std::size_t n = nb_nodes();
+    for (std::size_t p = 0; p < n; ++p) {
+        std::uint_least32_t *dp = d + p * lanes;
+        for (std::size_t i = in_offsets[p]; i < in_offsets[p+1]; ++i) {
+            const std::uint_least32_t l = edg[i].len;
+            const std::uint_least32_t *dq = d + std::size_t(edg[i].tail) * lanes;
+            // sat_add() lane by lane:
+#if defined(__AVX512F__)
+            const std::uint_least32_t lim = infinity - l;
+            const __m512i vl = _mm512_set1_epi32(l), vlim = _mm512_set1_epi32(lim);
+            __m512i vq = _mm512_loadu_si512(dq);
+            __m512i vp = _mm512_loadu_si512(dp);
+            vq = _mm512_add_epi32(_mm512_min_epu32(vq, vlim), vl);
+            _mm512_storeu_si512(dp, _mm512_min_epu32(vp, vq));
+#elif defined(__AVX2__)
+            const std::uint_least32_t lim = infinity - l;
+            const __m256i vl = _mm256_set1_epi32(l), vlim = _mm256_set1_epi32(lim);
+            for (int k = 0; k < lanes; k += 8) {
+                __m256i vq = _mm256_loadu_si256((const __m256i *)(dq + k));
+                __m256i vp = _mm256_loadu_si256((const __m256i *)(dp + k));
+                vq = _mm256_add_epi32(_mm256_min_epu32(vq, vlim), vl);
+                _mm256_storeu_si256((__m256i *)(dp + k), _mm256_min_epu32(vp, vq));
+            }
+#else
+            for (int k = 0; k < lanes; ++k) {
+                dp[k] = std::min(dp[k], sat_add(dq[k], l));
+            }
+#endif
+        }
+    }
+}
+
+void phast::one_to_all(node src) {
+    dists.assign(nb_nodes(), infinity);
+    query.forward_search_space(src, [this](node_dist ud) {
+            dists[position[ud._node]] = ud._dist;
+        });
+    sweep();
+}
+
+void phast::one_to_all_batch(const std::vector<node> & sources) {
+    assert(sources.size() <= lanes);
+    batch_dists.assign(nb_nodes() * lanes, infinity);
+    for (std::size_t k = 0; k < sources.size(); ++k) {
+        query.forward_search_space(sources[k], [this, k](node_dist ud) {
+                batch_dists[position[ud._node] * lanes + k] = ud._dist;
+            });
+    }
+    sweep_batch();
+}
+
+std::vector<dist> phast::many_to_all(const std::vector<node> & sources) {
+    const std::size_t n = nb_nodes();
+    std::vector<dist> res(sources.size() * n);
+    std::vector<node> batch;
+    for (std::size_t b = 0; b < sources.size(); b += lanes) {
+        const std::size_t nb = std::min(std::size_t(lanes), sources.size() - b);
+        batch.assign(sources.begin() + b, sources.begin() + b + nb);
+        one_to_all_batch(batch);
+        for (std::size_t k = 0; k < nb; ++k) {
+            dist *row = res.data() + (b + k) * n;
+            for (node v : irange<node>(node(0), node(n))) {
+                row[v] = distance(k, v);
+            }
+        }
+    }
+    return res;
+}
+
+
+rphast::rphast(const ch_query & q, const std::vector<node> & targets)
+    : query(q), targets(targets), position(q.nb_nodes(), no_pos)
+{
+    const std::size_t n = q.nb_nodes();
+    const ch_index & ix = *q.index();
+    const auto & rank = ix.ranks(); // by internal id
+    const static_digraph & up_bwd = ix.upward_bwd();
+
+    // Restricted set: nodes reaching a target by downward edges (in
+    // internal ids), up_bwd[v] contains downward edges u->v reversed:
+    std::vector<bool> restricted(n, false);
+    std::vector<node> sweep;
+    for (node t : targets) {
+        node i = ix.internal(t);
+        if ( ! restricted[i]) { restricted[i] = true; sweep.push_back(i); }
+    }
+    for (std::size_t k = 0; k < sweep.size(); ++k) {
+        const node v = sweep[k];
+        for (auto e : up_bwd.out_neighbors(v)) {
+            if (rank[e.dst] > rank[v] && ! restricted[e.dst]) {
+                restricted[e.dst] = true;
+                sweep.push_back(e.dst);
+            }
+        }
+    }
+    std::sort(sweep.begin(), sweep.end(), [&rank](node u, node v) {
+            return rank[u] > rank[v] || (rank[u] == rank[v] && u < v);
+        });
+    std::vector<pos_t> internal_position(n, no_pos);
+    for (std::size_t p = 0; p < sweep.size(); ++p) {
+        internal_position[sweep[p]] = pos_t(p);
+        position[ix.external(sweep[p])] = pos_t(p);
+    }
+    for (node t : targets) { target_position.push_back(position[t]); }
+
+    in_offsets.reserve(sweep.size() + 1);
+    in_offsets.push_back(0);
+    for (node v : sweep) {
+        for (auto e : up_bwd.out_neighbors(v)) {
+            if (rank[e.dst] > rank[v]) {
+                in_edges.push_back({ internal_position[e.dst], e.len });
+            }
+        }
+        in_offsets.push_back(in_edges.size());
+    }
+}
+
+void rphast::one_to_many(node src, dist limit) {
+    const std::size_t n = restricted_size();
+    dists.assign(n, infinity);
+    query.forward_search_space(src, [this](node_dist ud) {
+            const pos_t p = position[ud._node];
+            if (p != no_pos) { dists[p] = ud._dist; }
+        }, limit);
+    // Sweep, nodes further than [lim] are pruned. Pruning mixes finite
+    // and infinite distances: sums are computed on 64 bits and compared
+    // without branches (infinity has all bits set).
+    const std::uint64_t lim = limit;
+    std::uint_least32_t *d = dists.data();
+    const in_edge *edg = in_edges.data();
+    for (std::size_t p = 0; p < n; ++p) {
+        std::uint64_t dp = d[p];
+        for (std::size_t i = in_offsets[p]; i < in_offsets[p+1]; ++i) {
+            dp = std::min(dp, std::uint64_t(d[edg[i].tail]) + edg[i].len);
+        }
+        d[p] = std::uint_least32_t(dp) | (0u - std::uint_least32_t(dp > lim));
+    }
+}
+
+std::vector<node> rphast::isochrone(node src, dist limit) {
+    one_to_many(src, limit);
+    std::vector<node> res;
+    for (std::size_t k = 0; k < targets.size(); ++k) {
+        if (distance(k) <= limit) { res.push_back(targets[k]); }
+    }
+    return res;
+}
+
+
+namespace unit {
+
+    void test_phast() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            for (float max_deg : {std::numeric_limits<float>::max(), 3.f}) {
+                contraction contr(g);
+                contr.contract(max_deg); // full or partial
+                phast ph(contr.query_engine());
+                traversal<digraph> trav;
+                std::vector<node> srcs;
+                const std::size_t incr = std::max(std::size_t(1), g.n() / 20);
+                for (std::size_t i = 0; i < g.n(); i += incr) {
+                    srcs.push_back(node(i));
+                }
+                std::vector<dist> mat = ph.many_to_all(srcs);
+                for (std::size_t i = 0; i < srcs.size(); ++i) {
+                    trav.dijkstra(g, srcs[i]);
+                    ph.one_to_all(srcs[i]);
+                    for (node v : g) {
+                        CHECK(ph.distance(v) == trav.distance(v));
+                        CHECK(mat[i * g.n() + v] == trav.distance(v));
+                    }
+                }
+
+                // Restricted to some targets, with and without limit:
+                std::vector<node> tgts;
+                for (std::size_t i = 3; i < g.n(); i += 2 * incr) {
+                    tgts.push_back(node(i));
+                }
+                tgts.push_back(tgts[0]); // duplicates are allowed
+                rphast rph(contr.query_engine(), tgts);
+                CHECK(rph.restricted_size() <= g.n());
+                for (node s : srcs) {
+                    trav.dijkstra(g, s);
+                    rph.one_to_many(s);
+                    for (std::size_t k = 0; k < tgts.size(); ++k) {
+                        CHECK(rph.distance(k) == trav.distance(tgts[k]));
+                    }
+                    const dist limit = trav.distance(tgts[tgts.size() / 2]);
+                    std::vector<node> iso = rph.isochrone(s, limit), in;
+                    for (std::size_t k = 0; k < tgts.size(); ++k) {
+                        if (trav.distance(tgts[k]) <= limit) {
+                            in.push_back(tgts[k]);
+                            CHECK(rph.distance(k) == trav.distance(tgts[k]));
+                        } else {
+                            CHECK(rph.distance(k) == dist_max);
+                        }
+                    }
+                    CHECK(iso == in);
+                }
+            }
+        }
+    }
+
+}
+
+}
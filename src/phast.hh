@@ -0,0 +1,138 @@
+// PHAST: one-to-all distances with a contraction hierarchy.
+
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include "basics.hh"
+#include "ch_query.hh"
+
+namespace ch {
+
+/** Distances from a source [s] to all nodes are obtained by a forward
+ * upward search from [s] followed by a sweep over all nodes by decreasing
+ * rank: the distance of node v is the minimum of its upward search distance
+ * and of d(u) + l for each downward edge u->v of length l (u has higher
+ * rank and has thus already been swept).
+ * Nodes are renumbered by sweep position so that the sweep is a linear scan
+ * of the distance array, downward edges being grouped by head.
+ * Uncontracted nodes (partial hierarchy) come first and get their exact
+ * distance from the upward search which explores them all.
+ *
+ * Batches of sources are swept together: the distances of [lanes] sources
+ * are stored contiguously for each node, and each downward edge is relaxed
+ * for all of them at once (with AVX2/AVX-512 instructions when compiled for
+ * them, e.g. with cmake -DNATIVE=ON).
+ */
+class phast {
+
+public:
+    static constexpr int lanes = 16; // sources per batch sweep
+    using pos_t = std::uint_least32_t; // position in the sweep
+
+protected:
+    // A downward edge into the node at some position:
+    struct in_edge {
+        pos_t tail; // position of the tail
+        std::uint_least32_t len;
+    };
+
+    ch_query query; // for upward searches
+    std::vector<node> order; // node at each position
+    std::vector<pos_t> position; // position of each node
+    std::vector<std::size_t> in_offsets; // in_edges of each position
+    std::vector<in_edge> in_edges;
+    std::vector<std::uint_least32_t> dists; // by position
+    std::vector<std::uint_least32_t> batch_dists; // by position and lane
+
+    void sweep() ;
+    void sweep_batch() ;
+
+public:
+
+    explicit phast(const ch_query & q) ;
+
+    std::size_t nb_nodes() const { return order.size(); }
+
+    // Compute distances from [src], they can then be read with distance().
+    void one_to_all(node src) ;
+
+    // Distance from the source of the last call to one_to_all() to [v].
+    dist distance(node v) const { return dist(dists[position[v]]); }
+
+    // Compute distances from each of [sources] (at most [lanes]), they can
+    // then be read with distance(k, v) for sources[k].
+    void one_to_all_batch(const std::vector<node> & sources) ;
+
+    // Distance from the k-th source of the last batch to [v].
+    dist distance(std::size_t k, node v) const {
+        return dist(batch_dists[position[v] * lanes + k]);
+    }
+
+    // Returns the distances from each source to all nodes as a matrix
+    // stored row by row: the distance from sources[i] to node v is at index
+    // i * nb_nodes() + v. Sources are processed by batches of [lanes].
+    std::vector<dist> many_to_all(const std::vector<node> & sources) ;
+};
+
+/** RPHAST: distances from a source to a fixed set of targets. Only nodes
+ * from which a target can be reached by downward edges are swept: they are
+ * found once by a search from the targets in the reverse of downward
+ * edges (the restricted set), and stored as in phast by decreasing rank
+ * with their downward edges grouped by head. A query is then a forward
+ * upward search from the source followed by a sweep of the restricted set.
+ *
+ * With a distance limit, the upward search stops at the limit and nodes
+ * further than the limit get an infinite distance during the sweep, which
+ * gives isochrones (targets within some distance). With all nodes as
+ * targets, the restricted set is the whole graph as in phast.
+ */
+class rphast {
+
+public:
+    using pos_t = phast::pos_t;
+    static constexpr pos_t no_pos = std::numeric_limits<pos_t>::max();
+
+protected:
+    struct in_edge {
+        pos_t tail; // position of the tail
+        std::uint_least32_t len;
+    };
+
+    ch_query query; // for upward searches
+    std::vector<node> targets;
+    std::vector<pos_t> position; // in the restricted set of each node
+    std::vector<pos_t> target_position;
+    std::vector<std::size_t> in_offsets; // in_edges of each position
+    std::vector<in_edge> in_edges;
+    std::vector<std::uint_least32_t> dists; // by position
+
+public:
+
+    rphast(const ch_query & q, const std::vector<node> & targets) ;
+
+    std::size_t nb_targets() const { return targets.size(); }
+
+    // Number of nodes swept by a query.
+    std::size_t restricted_size() const { return in_offsets.size() - 1; }
+
+    // Compute distances from [src] to the targets, they can then be read
+    // with distance(). Distances greater than [limit] are infinite.
+    void one_to_many(node src, dist limit = dist_max) ;
+
+    // Distance from the source of the last call to one_to_many() to the
+    // k-th target.
+    dist distance(std::size_t k) const {
+        return dist(dists[target_position[k]]);
+    }
+
+    // Targets at distance at most [limit] from [src] (in target order).
+    std::vector<node> isochrone(node src, dist limit) ;
+};
+
+namespace unit {
+    void test_phast();
+}
+
+}
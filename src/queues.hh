@@ -0,0 +1,200 @@
+// Priority queues of nodes keyed by distance, used as queue policies by
+// traversal. All policies provide:
+//   empty(), size(), top(), pop(),
+//   push(u, d) : insert node [u] with key [d] (or decrease its key),
+//   reserve(n) : allow node indexes up to n-1,
+//   clear(f)   : empty the queue, calling f(u) for each node u it contained.
+// With lazy policies ([lazy] is true), a node can be pushed several times
+// (the traversal skips stale entries of already visited nodes when popping,
+// it does not check for them with addressable policies).
+
+#pragma once
+
+#include <queue>
+#include <vector>
+#include <limits>
+
+#include "basics.hh"
+
+namespace ch {
+
+struct node_dist {
+    node _node;
+    dist _dist;
+    node_dist(node _node, dist _dist) : _node(_node), _dist(_dist) {}
+    node_dist() : _node(-1), _dist(dist_max) {}
+    operator node() const { return _node; }
+};
+
+
+// Binary heap of std::priority_queue with lazy deletion.
+class lazy_queue {
+    struct node_dist_greater {
+        bool operator()(node_dist a, node_dist b) const {
+            return b._dist < a._dist; // priority_queue::top() is max element
+        }
+    };
+    using queue_t = std::priority_queue <node_dist,
+                                         std::vector<node_dist>,
+                                         node_dist_greater>;
+    queue_t queue;
+
+public:
+    static constexpr bool lazy = true;
+
+    bool empty() const { return queue.empty(); }
+    std::size_t size() const { return queue.size(); }
+    node_dist top() const { return queue.top(); }
+    void pop() { queue.pop(); }
+    void push(node u, dist d) { queue.push(node_dist(u, d)); }
+    void reserve(std::size_t n) {}
+    template <typename F>
+    void clear(F f) {
+        for ( ; ! queue.empty() ; queue.pop()) { f(queue.top()._node); }
+    }
+};
+
+
+// Addressable D-ary heap with decrease-key: each node appears at most once,
+// its position in the heap is stored in an array indexed by nodes.
+template <int D = 4>
+class dary_heap {
+    using pos_t = std::uint_least32_t;
+    static constexpr pos_t not_in_heap = std::numeric_limits<pos_t>::max();
+    std::vector<node_dist> heap;
+    std::vector<pos_t> pos;
+
+    void place(std::size_t i, node_dist ud) {
+        heap[i] = ud;
+        pos[ud._node] = pos_t(i);
+    }
+
+    void sift_up(std::size_t i, node_dist ud) {
+        while (i > 0) {
+            std::size_t par = (i - 1) / D;
+            if ( ! (ud._dist < heap[par]._dist)) break;
+            place(i, heap[par]);
+            i = par;
+        }
+        place(i, ud);
+    }
+
+    void sift_down(std::size_t i, node_dist ud) {
+        const std::size_t sz = heap.size();
+        while (true) {
+            std::size_t first = D * i + 1;
+            if (first >= sz) break;
+            std::size_t last = std::min(first + D, sz), min = first;
+            for (std::size_t c = first + 1; c < last; ++c) {
+                if (heap[c]._dist < heap[min]._dist) { min = c; }
+            }
+            if ( ! (heap[min]._dist < ud._dist)) break;
+            place(i, heap[min]);
+            i = min;
+        }
+        place(i, ud);
+    }
+
+public:
+    static constexpr bool lazy = false;
+
+    bool empty() const { return heap.empty(); }
+    std::size_t size() const { return heap.size(); }
+    node_dist top() const { return heap.front(); }
+
+    void pop() {
+        pos[heap.front()._node] = not_in_heap;
+        node_dist last = heap.back();
+        heap.pop_back();
+        if ( ! heap.empty()) { sift_down(0, last); }
+    }
+
+    void push(node u, dist d) {
+        pos_t i = pos[u];
+        if (i == not_in_heap) {
+            heap.emplace_back();
+            sift_up(heap.size() - 1, node_dist(u, d));
+        } else if (d < heap[i]._dist) {
+            sift_up(i, node_dist(u, d));
+        }
+    }
+
+    void reserve(std::size_t n) {
+        if (n > pos.size()) { pos.resize(n, not_in_heap); }
+    }
+
+    template <typename F>
+    void clear(F f) {
+        for (node_dist ud : heap) {
+            pos[ud._node] = not_in_heap;
+            f(ud._node);
+        }
+        heap.clear();
+    }
+};
+
+
+// Monotone radix heap for integer keys: keys pushed must be at least the
+// key of the last element popped (which is the case in Dijkstra-like
+// traversals). An element with key d is stored in the bucket indexed by
+// the highest bit where d differs from the last key popped.
+class radix_heap {
+    using key_t = std::uint_least32_t;
+    static constexpr int nb_buckets = std::numeric_limits<key_t>::digits + 1;
+    mutable std::vector<node_dist> buckets[nb_buckets];
+    mutable key_t last;
+    std::size_t _size;
+
+    static int bucket(key_t d, key_t last) {
+        return d == last ? 0
+            : std::numeric_limits<key_t>::digits - __builtin_clz(d ^ last);
+    }
+
+    // Ensure bucket 0 is not empty by redistributing the first non-empty
+    // bucket according to its minimum key.
+    void refill() const {
+        assert(_size > 0);
+        if ( ! buckets[0].empty()) return;
+        int i = 1;
+        while (buckets[i].empty()) { ++i; }
+        key_t min = buckets[i][0]._dist;
+        for (node_dist ud : buckets[i]) {
+            if (ud._dist < min) { min = ud._dist; }
+        }
+        last = min;
+        for (node_dist ud : buckets[i]) {
+            buckets[bucket(ud._dist, last)].push_back(ud);
+        }
+        buckets[i].clear();
+    }
+
+public:
+    static constexpr bool lazy = true;
+
+    radix_heap() : last(0), _size(0) {}
+
+    bool empty() const { return _size == 0; }
+    std::size_t size() const { return _size; }
+    node_dist top() const { refill(); return buckets[0].back(); }
+    void pop() { refill(); buckets[0].pop_back(); --_size; }
+
+    void push(node u, dist d) {
+        assert(key_t(d) >= last);
+        buckets[bucket(d, last)].push_back(node_dist(u, d));
+        ++_size;
+    }
+
+    void reserve(std::size_t n) {}
+
+    template <typename F>
+    void clear(F f) {
+        for (auto & b : buckets) {
+            for (node_dist ud : b) { f(ud._node); }
+            b.clear();
+        }
+        last = 0;
+        _size = 0;
+    }
+};
+
+}
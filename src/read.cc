@@ -41,14 +41,15 @@ int main (int argc, char **argv) {
     std::string fgraph (argv[1]);
 
     // ------------------------- load graph ----------------------
-    label_edges labedg(fgraph);
-    digraph g;
-    for (auto e : labedg.edges) { g.add(e); }
+    label_edges labedg;
+    digraph g = labedg.read_graph(fgraph);
     std::cerr <<"loaded graph with n=" << g.n() << " nodes"
               <<" and m=" << g.m() <<" edges\n";
     dist maxlen = 0;
-    for (auto e : labedg.edges) {
-        if (e.len > maxlen) { maxlen = e.len; }
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) {
+            if (e.len > maxlen) { maxlen = e.len; }
+        }
     }
     std::cerr <<"maximum edge length: "<< maxlen
               <<" (distance overflow at "<< dist_max <<")\n";
@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "static_digraph.hh"
+#include "traversal.hh"
+#include "label_edges.hh"
+
+namespace ch {
+
+static_digraph::static_digraph(const digraph & g) {
+    std::vector<offset> offs;
+    std::vector<head> hds;
+    offs.reserve(g.nb_nodes() + 1);
+    hds.reserve(g.nb_edges());
+    offs.push_back(0);
+    for (node u : g) {
+        for (auto e : g.out_neighbors(u)) { hds.push_back(e); }
+        offs.push_back(hds.size());
+    }
+    offsets = std::move(offs);
+    heads = std::move(hds);
+}
+
+static_digraph::static_digraph(frozen_array<offset> offsets,
+                               frozen_array<head> heads)
+    : offsets(std::move(offsets)), heads(std::move(heads)) {
+    CHECK(this->offsets.size() >= 1 && this->offsets[0] == 0);
+    CHECK(this->offsets[this->offsets.size() - 1] == this->heads.size());
+}
+
+std::vector<edge> static_digraph::to_edges() const {
+    std::vector<edge> edg;
+    edg.reserve(nb_edges());
+    for (node u : nodes()) {
+        for (auto e : out_neighbors(u)) { edg.push_back({ u, e }); }
+    }
+    return edg;
+}
+
+
+namespace unit {
+
+    void test_static_digraph() {
+        for (const digraph & g : {dg_small_ids, dg_road}) {
+            static_digraph sg(g);
+            CHECK(sg.nb_nodes() == g.nb_nodes());
+            CHECK(sg.nb_edges() == g.nb_edges());
+            for (node u : g) { CHECK(sg.out_degree(u) == g.out_degree(u)); }
+            CHECK(sg.to_edges() == g.to_edges());
+
+            // same distances with traversal<static_digraph> :
+            static_digraph sg_bwd(g.reverse());
+            traversal<digraph> trav;
+            traversal<static_digraph> strav, strav_bwd;
+            const std::size_t incr = std::max(std::size_t(1), g.n() / 10);
+            for (std::size_t i = 0; i < g.n(); i += incr) {
+                node u(i);
+                trav.dijkstra(g, u);
+                strav.dijkstra(sg, u);
+                CHECK(trav.copy_distances() == strav.copy_distances());
+                for (std::size_t j = 0; j < g.n(); j += incr) {
+                    node v(j);
+                    dist d = strav.bidir_dijkstra(sg, sg_bwd, strav_bwd, u, v);
+                    CHECK(d == trav.distance(v));
+                }
+            }
+        }
+        static_digraph empty;
+        CHECK(empty.nb_nodes() == 0 && empty.nb_edges() == 0);
+    }
+    
+}
+
+}
@@ -0,0 +1,96 @@
+/** Immutable digraph in compressed sparse row (CSR) format: the out-edges
+ * of all nodes are packed in a single array, out-edges of node u being
+ * at positions offsets[u] to offsets[u+1]-1.
+ * It provides the same interface as digraph for reading, so that
+ * traversal<static_digraph> can be used for faster queries once a graph
+ * will not change anymore (e.g. a contraction hierarchy).
+ * Arrays are frozen_arrays: copies are cheap and share memory, and a
+ * static_digraph can directly use arrays of a memory-mapped file.
+ *
+ * Basic example:
+ *
+ *  #include "static_digraph.hh"
+ *
+ *    digraph g;
+ *    g.add_edge(0, 1, 12);
+ *    g.add_edge(1, 2, 14);
+ *    static_digraph sg(g);
+ *    for (node u : sg) {
+ *        for (auto e : sg[u]) { std::cout << e.dst <<" "<< e.len <<" "; } 
+ *    }
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "basics.hh"
+#include "ranges.hh"
+#include "digraph.hh"
+#include "frozen_array.hh"
+
+namespace ch {
+
+class static_digraph {
+
+public:
+
+    using head = edge_head;
+    using graph = static_digraph;
+    using offset = std::uint64_t;
+
+protected:
+
+    frozen_array<offset> offsets; // n+1 offsets in heads
+    frozen_array<head> heads;
+
+public:
+
+    static_digraph() : offsets(std::vector<offset>(1, 0)) {}
+
+    // Freeze [g], out-neighbors of each node are kept in the same order.
+    explicit static_digraph(const digraph & g) ;
+
+    // Graph with out-edges of [u] at [heads[offsets[u]..offsets[u+1]-1]].
+    static_digraph(frozen_array<offset> offsets, frozen_array<head> heads) ;
+
+    // Raw arrays (e.g. for saving the graph to a file).
+    const frozen_array<offset> & offset_array() const { return offsets; }
+    const frozen_array<head> & head_array() const { return heads; }
+
+    std::size_t nb_nodes() const { return offsets.size() - 1; }
+    std::size_t n() const { return nb_nodes(); } // almost standard
+
+    std::size_t nb_edges() const { return heads.size(); }
+    std::size_t m() const { return nb_edges(); } // almost standard
+
+    std::size_t out_degree(node u) const {
+        return offsets[u+1u] - offsets[u];
+    }
+
+    irange<node> nodes() const { return irange<node>(node(0), node(n())); }
+    
+    // iterator for the graph itself is equivalent to nodes()
+    int_iterator<node> begin() const { return int_iterator<node>(node(0));}
+    int_iterator<node> end() const { return int_iterator<node>(node(n())); }
+
+    using hrange = crange<frozen_array<head>>;
+
+    hrange out_neighbors(node u) const {
+        assert(u < nb_nodes());
+        return hrange(heads.cbegin() + offsets[u],
+                      heads.cbegin() + offsets[u+1u]);
+    }
+
+    // an alias for out_neighbors() :
+    hrange operator[](node u) const { return out_neighbors(u); } 
+
+    std::vector<edge> to_edges() const ;
+};
+
+namespace unit {
+    void test_static_digraph() ;
+}
+
+}
@@ -0,0 +1,106 @@
+#include "stats.hh"
+#include "traversal.hh"
+#include "contraction.hh"
+#include "label_edges.hh"
+
+#include <sstream>
+
+namespace ch {
+
+traversal_stats & traversal_stats::operator+=(const traversal_stats & o) {
+    settled += o.settled;
+    relaxed += o.relaxed;
+    pushes += o.pushes;
+    stale_pops += o.stale_pops;
+    full_resets += o.full_resets;
+    sparse_resets += o.sparse_resets;
+    return *this;
+}
+
+void traversal_stats::json(std::ostream & os) const {
+    os <<"{\"settled\": "<< settled <<", \"relaxed\": "<< relaxed
+       <<", \"pushes\": "<< pushes <<", \"stale_pops\": "<< stale_pops
+       <<", \"full_resets\": "<< full_resets
+       <<", \"sparse_resets\": "<< sparse_resets <<"}";
+}
+
+round_stats & round_stats::operator+=(const round_stats & o) {
+    contracted += o.contracted;
+    witness_searches += o.witness_searches;
+    witness_hits += o.witness_hits;
+    shortcuts_added += o.shortcuts_added;
+    shortcuts_updated += o.shortcuts_updated;
+    ms += o.ms;
+    return *this;
+}
+
+void round_stats::json(std::ostream & os) const {
+    os <<"{\"contracted\": "<< contracted
+       <<", \"witness_searches\": "<< witness_searches
+       <<", \"witness_hits\": "<< witness_hits
+       <<", \"shortcuts_added\": "<< shortcuts_added
+       <<", \"shortcuts_updated\": "<< shortcuts_updated
+       <<", \"ms\": "<< ms <<"}";
+}
+
+round_stats contraction_stats::total() const {
+    round_stats tot;
+    for (const round_stats & r : rounds) { tot += r; }
+    return tot;
+}
+
+void contraction_stats::json(std::ostream & os) const {
+    os <<"{\"enabled\": "<< (stats_enabled ? "true" : "false")
+       <<", \"graph_bytes\": "<< graph_bytes <<",\n \"total\": ";
+    total().json(os);
+    os <<",\n \"witness\": ";
+    witness.json(os);
+    os <<",\n \"rounds\": [";
+    for (std::size_t i = 0; i < rounds.size(); ++i) {
+        os << (i > 0 ? ",\n  " : "\n  ");
+        rounds[i].json(os);
+    }
+    os <<"]}";
+}
+
+namespace unit {
+
+    void test_stats() {
+        const digraph & g = dg_road;
+        traversal<digraph> trav;
+        trav.dijkstra(g, node(0));
+        const traversal_stats & ts = trav.stats();
+        if (stats_enabled) {
+            CHECK(ts.settled == trav.settled_nodes().size());
+            CHECK(ts.relaxed >= ts.settled - 1);
+            CHECK(ts.pushes >= ts.settled);
+            CHECK(ts.full_resets + ts.sparse_resets == 1);
+        } else {
+            CHECK(ts.settled == 0 && ts.relaxed == 0 && ts.pushes == 0);
+        }
+
+        contraction contr(g);
+        contr.contract();
+        const contraction_stats & cs = contr.stats();
+        CHECK(cs.graph_bytes > 0);
+        const round_stats tot = cs.total();
+        if (stats_enabled) {
+            CHECK(tot.contracted == g.nb_nodes());
+            CHECK(tot.witness_searches > 0);
+            CHECK(tot.witness_searches == cs.witness.full_resets
+                                          + cs.witness.sparse_resets);
+        } else {
+            CHECK(tot.contracted == 0 && tot.witness_searches == 0);
+        }
+        std::ostringstream os;
+        cs.json(os);
+        CHECK(os.str().find("\"witness_hits\"") != std::string::npos);
+
+        CHECK(g.memory_bytes() >= g.nb_edges() * sizeof(edge_head));
+        CHECK(edges_road.memory_bytes()
+              >= edges_road.edges.size() * sizeof(edge));
+    }
+
+}
+
+}
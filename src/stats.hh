@@ -0,0 +1,70 @@
+// Counters on hot paths of traversals and contraction.
+
+/** Counters are only incremented when compiled with CH_STATS defined
+ * (cmake -DSTATS=ON ..), CH_STAT(x) executes [x] in that case and
+ * vanishes otherwise. Stats structures are always present so that code
+ * reading them compiles in both cases (they then remain zero).
+ *
+ * Example:
+ *
+ *    traversal<digraph> trav;
+ *    trav.dijkstra(g, src);
+ *    trav.stats().json(std::cout); // {"settled": ..., "relaxed": ...}
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+namespace ch {
+
+#ifdef CH_STATS
+    constexpr bool stats_enabled = true;
+#   define CH_STAT(x) do { x; } while (0)
+#else
+    constexpr bool stats_enabled = false;
+#   define CH_STAT(x) do { } while (0)
+#endif
+
+struct traversal_stats {
+    std::uint64_t settled = 0;
+    std::uint64_t relaxed = 0; // edges scanned
+    std::uint64_t pushes = 0; // heap insertions and decrease keys
+    std::uint64_t stale_pops = 0; // popped nodes already settled
+    std::uint64_t full_resets = 0; // init() filling all arrays
+    std::uint64_t sparse_resets = 0; // init() resetting visited nodes only
+
+    traversal_stats & operator+=(const traversal_stats & o) ;
+    void json(std::ostream & os) const ;
+};
+
+// Counters of one round of contract() (a batch of nodes for
+// contraction::ordering::lazy_priority).
+struct round_stats {
+    std::uint64_t contracted = 0;
+    std::uint64_t witness_searches = 0;
+    std::uint64_t witness_hits = 0; // shortcuts avoided by a witness path
+    std::uint64_t shortcuts_added = 0;
+    std::uint64_t shortcuts_updated = 0; // existing edges made shorter
+    double ms = 0;
+
+    round_stats & operator+=(const round_stats & o) ;
+    void json(std::ostream & os) const ;
+};
+
+struct contraction_stats {
+    std::vector<round_stats> rounds;
+    traversal_stats witness; // all witness searches
+    std::size_t graph_bytes = 0; // held by the forward and backward graphs
+
+    round_stats total() const ;
+    void json(std::ostream & os) const ;
+};
+
+namespace unit {
+    void test_stats();
+}
+
+}
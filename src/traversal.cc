@@ -49,6 +49,26 @@ namespace unit {
             }
             std::cout <<"\n";
         }
+
+        // All queue policies give the same distances:
+        traversal<digraph, lazy_queue> lazy_trav, lazy_bwd;
+        traversal<digraph, radix_heap> radix_trav, radix_bwd;
+        traversal<digraph, dary_heap<2>> bin_trav, bin_bwd;
+        for (node u : ids) {
+            trav.dijkstra(fwd, u);
+            lazy_trav.dijkstra(fwd, u);
+            radix_trav.dijkstra(fwd, u);
+            bin_trav.dijkstra(fwd, u);
+            CHECK(trav.copy_distances() == lazy_trav.copy_distances());
+            CHECK(trav.copy_distances() == radix_trav.copy_distances());
+            CHECK(trav.copy_distances() == bin_trav.copy_distances());
+            for (node v : ids) {
+                dist d = trav.distance(v);
+                CHECK(d == lazy_trav.bidir_dijkstra(fwd, bwd, lazy_bwd, u, v));
+                CHECK(d == radix_trav.bidir_dijkstra(fwd, bwd, radix_bwd, u, v));
+                CHECK(d == bin_trav.bidir_dijkstra(fwd, bwd, bin_bwd, u, v));
+            }
+        }
          
     }
 }
@@ -4,19 +4,28 @@
 
 #pragma once
 
-#include <queue>
 #include <vector>
 
 #include "basics.hh"
 #include "digraph.hh"
+#include "queues.hh"
+#include "stats.hh"
 
 namespace ch {
 
-template <typename G = digraph> // graph type
+// Filter for traversals accepting all nodes. Filters are template
+// parameters of traversal methods so that this one costs nothing.
+struct no_filter {
+    bool operator()(node v, dist d) const { return true; }
+    bool operator()(node v, dist d, node par) const { return true; }
+};
+
+template <typename G = digraph, // graph type
+          typename Q = dary_heap<4>> // queue policy (see queues.hh)
 class traversal {
 
 public:
-    using trav = traversal<G>;
+    using trav = traversal<G, Q>;
     using graph = G;
     using node = node;
     using dist = dist;
@@ -24,33 +33,28 @@ public:
 
 protected:
 
-    // For the priority queue:
-    struct node_dist {
-        node _node;
-        dist _dist;
-        node_dist(node _node, dist _dist) : _node(_node), _dist(_dist) {}
-        node_dist() : _node(-1), _dist(dist_infinity) {}
-        operator node() const { return _node; }
-    };
-    static bool node_dist_greater(node_dist a, node_dist b) {
-        return b._dist < a._dist; // priority_queue::top() returns max element
-    }
-    
     std::vector<dist> distances;
-    using queue_t = std::priority_queue <node_dist,
-                                         std::vector<node_dist>,
-                                   std::function<bool(node_dist, node_dist)>>;
-    queue_t queue;
+    Q queue;
     std::vector<bool> visited;
     std::vector<node> visited_nodes;
+    std::vector<unsigned> hops; // number of edges (for limited_dijkstra())
     std::size_t capacity;
+    traversal_stats counters; // see stats.hh
 
 public:
     
-    traversal() : queue(node_dist_greater), capacity(0) {}
+    traversal() : capacity(0) {}
 
     dist distance(node u) const { return distances[u]; }
 
+    // Nodes settled by the last search (in order).
+    const std::vector<node> & settled_nodes() const { return visited_nodes; }
+
+    // Counters since construction or last clear_stats() (only incremented
+    // with CH_STATS defined).
+    const traversal_stats & stats() const { return counters; }
+    void clear_stats() { counters = traversal_stats(); }
+
     std::vector<dist> copy_distances() const {
         return std::vector<dist>(distances.begin(), distances.begin()+capacity);
     }
@@ -62,19 +66,20 @@ public:
         // Queue has penalty in scanning elements but some cache locality:
         const std::size_t n_last = visited_nodes.size() + 2 * queue.size();
         if (n_last > capacity / 10) {
+            CH_STAT(++counters.full_resets);
             std::fill(distances.begin(), distances.end(), dist_infinity);
             std::fill(visited.begin(), visited.end(), false);
-            queue = queue_t(node_dist_greater);
+            queue.clear([](node u) {});
         } else {
+            CH_STAT(++counters.sparse_resets);
             for(node u : visited_nodes) {
                 distances[u] = dist_infinity;
                 visited[u] = false;
             }
-            for ( ; ! queue.empty() ; queue.pop()) {
-                const node u = queue.top();
-                distances[u] = dist_infinity;
-                visited[u] = false;
-            }
+            queue.clear([this](node u) {
+                    distances[u] = dist_infinity;
+                    visited[u] = false;
+                });
         }
         visited_nodes.clear();
 
@@ -82,33 +87,88 @@ public:
             distances.resize(n, dist_infinity);
             visited.resize(n, false);
         }
+        queue.reserve(n);
         capacity = n;
     }
 
-    void dijkstra(const graph & g, const node src,
-                  std::function<bool(node, dist)> filter
-                                     = [](node v, dist d) { return true; }
-                  ) {
+    // Only nodes [v] for which [filter(v, dv)] returns [true] are visited.
+    template <typename F = no_filter> // callable as bool(node, dist)
+    void dijkstra(const graph & g, const node src, F filter = F()) {
         init(g.nb_nodes());
         distances[src] = 0;
-        queue.push(node_dist(src, 0));
+        queue.push(src, 0);
+        CH_STAT(++counters.pushes);
 
         while ( ! queue.empty()) {
             node_dist ud = queue.top();
             queue.pop();
             node u = ud._node;
-            if ( ! visited[u] ) {
-                dist du = ud._dist;
-                assert(du == distances[u]);
-                visited[u] = true;
-                visited_nodes.push_back(u);
-                for (auto e : g.out_neighbors(u)) {
-                    node v = e.head();
-                    dist dv = du + dist(e.length());
-                    if (filter(v, dv) && dv < distances[v]) {
-                        distances[v] = dv;
-                        queue.push(node_dist(v, dv));
-                    }
+            if (Q::lazy && visited[u]) { // stale entry
+                CH_STAT(++counters.stale_pops);
+                continue;
+            }
+            dist du = ud._dist;
+            assert( ! visited[u] && du == distances[u]);
+            visited[u] = true;
+            visited_nodes.push_back(u);
+            CH_STAT(++counters.settled);
+            for (auto e : g.out_neighbors(u)) {
+                CH_STAT(++counters.relaxed);
+                node v = e.head();
+                dist dv = du + dist(e.length());
+                if (filter(v, dv) && dv < distances[v]) {
+                    distances[v] = dv;
+                    queue.push(v, dv);
+                    CH_STAT(++counters.pushes);
+                }
+            }
+        }
+    }
+
+    // Dijkstra from [src] limited to nodes at distance at most [dist_limit]:
+    // it stops when [stop(u)] returns [true] for a node [u] settled, or
+    // after settling [max_settled] nodes. Nodes reached with [max_hops]
+    // edges are not scanned. Only nodes [v] for which [filter(v, dv)]
+    // returns [true] are visited. After a limited search, distance(v) is
+    // the length of some path to [v] (infinity if none was found), which
+    // may not be a shortest one.
+    template <typename S, // callable as bool(node)
+              typename F = no_filter> // callable as bool(node, dist)
+    void limited_dijkstra(const graph & g, const node src,
+                          const dist dist_limit, const std::size_t max_settled,
+                          const unsigned max_hops, S stop, F filter = F()) {
+        init(g.nb_nodes());
+        if (hops.size() < distances.size()) { hops.resize(distances.size()); }
+        distances[src] = 0;
+        hops[src] = 0;
+        queue.push(src, 0);
+        CH_STAT(++counters.pushes);
+
+        while ( ! queue.empty() && visited_nodes.size() < max_settled) {
+            node_dist ud = queue.top();
+            if (dist_limit < ud._dist) break;
+            queue.pop();
+            node u = ud._node;
+            if (Q::lazy && visited[u]) { // stale entry
+                CH_STAT(++counters.stale_pops);
+                continue;
+            }
+            assert( ! visited[u]);
+            dist du = ud._dist;
+            visited[u] = true;
+            visited_nodes.push_back(u);
+            CH_STAT(++counters.settled);
+            if (stop(u)) break;
+            if (hops[u] >= max_hops) continue;
+            for (auto e : g.out_neighbors(u)) {
+                CH_STAT(++counters.relaxed);
+                node v = e.head();
+                dist dv = du + dist(e.length());
+                if (filter(v, dv) && dv < distances[v]) {
+                    distances[v] = dv;
+                    hops[v] = hops[u] + 1;
+                    queue.push(v, dv);
+                    CH_STAT(++counters.pushes);
                 }
             }
         }
@@ -122,13 +182,12 @@ public:
     // Only nodes [v] for which [filter(v, dv, par)] return [true] are visited.
     // If that prevents from visiting all nodes at distance less than [r]
     // before a node at distance [r], [pruned] must be set to [true].
+    template <typename F = no_filter> // callable as bool(node, dist, node)
     dist bidir_dijkstra(const graph & fwd, const graph & bwd, trav & bwd_trav, 
                         const node src, const node dst,
                         const dist dist_limit = dist_infinity,
                         const bool pruned = false, // is search pruned by:
-                        std::function<bool(node, dist, node)> filter
-                               = [](node v, dist d, node par) { return true; }
-                  ) {
+                        F filter = F()) {
         // few sanity checks:
         assert(this != & bwd_trav);
         assert(fwd.nb_nodes() == bwd.nb_nodes()
@@ -138,9 +197,9 @@ public:
         bwd_trav.init(fwd.nb_nodes());
 
         distances[src] = 0;
-        queue.push(node_dist(src, 0));
+        queue.push(src, 0);
         bwd_trav.distances[dst] = 0;
-        bwd_trav.queue.push(node_dist(dst, 0));
+        bwd_trav.queue.push(dst, 0);
         dist cur_dist_src_dst = dist_infinity, fwd_radius = 0, bwd_radius = 0;
 
         while ( ! (queue.empty() && bwd_trav.queue.empty()) ) {
@@ -168,51 +227,55 @@ public:
     }
 
     // Returns the current radius of the search : how far next node is from src
+    template <typename F>
     dist bidir_dijkstra_step(const graph & g,
                              dist & cur_dist_src_dst, const dist dist_limit,
                              const trav & oth_trav, const node oth,
                              const dist oth_radius, // progr. of other search
-                             std::function<bool(node, dist, node)> filter) {
+                             const F & filter) {
         assert(oth_radius < dist_infinity);
         if (queue.empty()) { return dist_infinity; }
-        node_dist ud;
-        do {
-            ud = queue.top(); queue.pop();
-        } while (visited[ud._node] && ! queue.empty());
+        node_dist ud = queue.top();
+        queue.pop();
+        while (Q::lazy && visited[ud._node]) { // stale entry
+            CH_STAT(++counters.stale_pops);
+            if (queue.empty()) { return dist_infinity; } // no more nodes
+            ud = queue.top();
+            queue.pop();
+        }
         node u = ud._node;
-        if ( ! visited[u] ){ 
-            dist du = ud._dist;
-            assert(du == distances[u]);
-            //std::cerr <<"bd_dijks: u="<< u <<" du="<< du <<" oth="<<oth<<"\n";
-            visited[u] = true;
-            visited_nodes.push_back(u);
-            if (u == oth) { // at destination
-                cur_dist_src_dst = du;
-                return du;
+        dist du = ud._dist;
+        assert( ! visited[u] && du == distances[u]);
+        //std::cerr <<"bd_dijks: u="<< u <<" du="<< du <<" oth="<<oth<<"\n";
+        visited[u] = true;
+        visited_nodes.push_back(u);
+        CH_STAT(++counters.settled);
+        if (u == oth) { // at destination
+            cur_dist_src_dst = du;
+            return du;
+        }
+        if (du + oth_radius >= cur_dist_src_dst) {// cannot improve
+            return du;
+        }
+        for (auto e : g.out_neighbors(u)) {
+            CH_STAT(++counters.relaxed);
+            node v = e.head();
+            dist dv = du + dist(e.length());
+            // do we meet other traversal?
+            dist d_v_oth = oth_trav.distances[v];
+            if (d_v_oth < dist_infinity && dv + d_v_oth < cur_dist_src_dst) {
+                cur_dist_src_dst = dv + d_v_oth;
             }
-            if (du + oth_radius >= cur_dist_src_dst) {// cannot improve
-                return du;
+            // Continue searching:
+            if (filter(v, dv, u) && dv < distances[v]
+                && dv + oth_radius < std::min(cur_dist_src_dst, dist_limit)
+                ) {
+                distances[v] = dv;
+                queue.push(v, dv);
+                CH_STAT(++counters.pushes);
             }
-            for (auto e : g.out_neighbors(u)) {
-                node v = e.head();
-                dist dv = du + dist(e.length());
-                // do we meet other traversal?
-                dist d_v_oth = oth_trav.distances[v];
-                if (d_v_oth < dist_infinity && dv + d_v_oth < cur_dist_src_dst) {
-                    cur_dist_src_dst = dv + d_v_oth;
-                }
-                // Continue searching:
-                if (filter(v, dv, u) && dv < distances[v]
-                    && dv + oth_radius < std::min(cur_dist_src_dst, dist_limit)
-                    ) {
-                    distances[v] = dv;
-                    queue.push(node_dist(v, dv));
-                }
-            }
-            return du;
         }
-        assert(queue.empty());
-        return dist_infinity; // no more nodes
+        return du;
     }
 
 };
@@ -1,9 +1,19 @@
 #include <iostream>
 
 #include "digraph.hh"
+#include "static_digraph.hh"
+#include "label_dict.hh"
 #include "label_edges.hh"
 #include "traversal.hh"
 #include "contraction.hh"
+#include "ch_query.hh"
+#include "core_table.hh"
+#include "hierarchy_file.hh"
+#include "phast.hh"
+#include "cch.hh"
+#include "hub_labels.hh"
+#include "knn.hh"
+#include "stats.hh"
 
 using namespace ch;
 
@@ -16,12 +26,34 @@ int main() {
 
     std::cerr <<" ----------- test_digraph()\n" << std::flush;
     unit::test_digraph();
+    std::cerr <<" ----------- test_label_dict()\n" << std::flush;
+    unit::test_label_dict();
     std::cerr <<" ----------- test_label_edges()\n" << std::flush;
     unit::test_label_edges();
+    std::cerr <<" ----------- test_static_digraph()\n" << std::flush;
+    unit::test_static_digraph();
     std::cerr <<" ----------- test_traversal()\n" << std::flush;
     unit::test_traversal();
     std::cerr <<" ----------- test_contraction()\n" << std::flush;
     unit::test_contraction();
+    std::cerr <<" ----------- test_edge_length_updates()\n" << std::flush;
+    unit::test_edge_length_updates();
+    std::cerr <<" ----------- test_ch_query()\n" << std::flush;
+    unit::test_ch_query();
+    std::cerr <<" ----------- test_core_table()\n" << std::flush;
+    unit::test_core_table();
+    std::cerr <<" ----------- test_hierarchy_file()\n" << std::flush;
+    unit::test_hierarchy_file();
+    std::cerr <<" ----------- test_phast()\n" << std::flush;
+    unit::test_phast();
+    std::cerr <<" ----------- test_cch()\n" << std::flush;
+    unit::test_cch();
+    std::cerr <<" ----------- test_hub_labels()\n" << std::flush;
+    unit::test_hub_labels();
+    std::cerr <<" ----------- test_knn()\n" << std::flush;
+    unit::test_knn();
+    std::cerr <<" ----------- test_stats()\n" << std::flush;
+    unit::test_stats();
     
     std::cerr <<"Unit tests done.\n";
     assert(false); // To check if assert() is active or not.